@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# Builds optimized versions of the library in the release directory:
+#
+#   libtapi.so  Shared library, built with LTO.
+#   libtapi.a   Static library.
+#   tapi-dump   tapi-dump linked against libtapi.a, for testing.
+#
+# Only the API marked with TAPI_PUBLIC in tapi.h is exported.
+#
+# Usage: ./build_release.sh [--pgo CORPUS_FILE...]
+#
+# With --pgo, this first builds an instrumented tapi-dump and runs it on the
+# corpus files (TBD files or dylibs) to record a profile, and then uses
+# the profile to optimize the library.  The corpus should resemble what the
+# library will load in production, for example the TBD files of an SDK.
+#
+# Set CXX to choose the compiler (default: clang++).  With Clang, PGO needs
+# llvm-profdata.
+
+set -ue
+
+CXX="${CXX:-clang++}"
+OUT="$(pwd)/release"
+
+PGO=
+if [ "${1:-}" = "--pgo" ]; then
+  shift
+  PGO=1
+  if [ $# -eq 0 ]; then
+    echo "Usage: $0 [--pgo CORPUS_FILE...]" >&2
+    exit 1
+  fi
+fi
+
+CLANG=
+if $CXX --version | grep -q clang; then
+  CLANG=1
+fi
+
+YAML_CFLAGS="$(pkg-config yaml-0.1 --cflags)"
+YAML_LIBS="$(pkg-config yaml-0.1 --libs)"
+CFLAGS="-O2 -DNDEBUG -std=c++14 -Iinclude $YAML_CFLAGS"
+CFLAGS="$CFLAGS -Wall -Wextra -Wno-missing-field-initializers"
+CFLAGS="$CFLAGS -fPIC -fvisibility=hidden -fvisibility-inlines-hidden"
+
+mkdir -p "$OUT"
+
+PGO_FLAGS=
+if [ -n "$PGO" ]; then
+  PROFILE_DIR="$OUT/profile"
+  rm -rf "$PROFILE_DIR"
+  mkdir -p "$PROFILE_DIR"
+
+  # GCC names the profile after the object file, so the instrumented
+  # object must have the same name as the optimized one.
+  $CXX $CFLAGS -fprofile-generate="$PROFILE_DIR" \
+    -c src/tapi.cpp -o "$OUT/tapi.o"
+  $CXX $CFLAGS -fprofile-generate="$PROFILE_DIR" \
+    dump/dump.cpp "$OUT/tapi.o" $YAML_LIBS -pthread \
+    -o "$OUT/tapi-dump-instrumented"
+  "$OUT/tapi-dump-instrumented" "$@" > /dev/null
+  rm "$OUT/tapi-dump-instrumented"
+
+  if [ -n "$CLANG" ]; then
+    llvm-profdata merge -output="$PROFILE_DIR/tapi.profdata" \
+      "$PROFILE_DIR"/*.profraw
+    PGO_FLAGS="-fprofile-use=$PROFILE_DIR/tapi.profdata"
+  else
+    PGO_FLAGS="-fprofile-use=$PROFILE_DIR -fprofile-correction"
+  fi
+fi
+
+# Clang's LTO objects can only be linked by an LTO-aware linker, so the
+# static library gets a separate ordinary object.  GCC can put both in one
+# object with -ffat-lto-objects.
+if [ -n "$CLANG" ]; then
+  $CXX $CFLAGS $PGO_FLAGS -flto -c src/tapi.cpp -o "$OUT/tapi.o"
+  $CXX $CFLAGS $PGO_FLAGS -c src/tapi.cpp -o "$OUT/tapi-static.o"
+  AR=ar
+else
+  $CXX $CFLAGS $PGO_FLAGS -flto -ffat-lto-objects \
+    -c src/tapi.cpp -o "$OUT/tapi.o"
+  cp "$OUT/tapi.o" "$OUT/tapi-static.o"
+  AR=gcc-ar
+fi
+
+$CXX $CFLAGS $PGO_FLAGS -flto -shared -Wl,-soname,libtapi.so \
+  "$OUT/tapi.o" $YAML_LIBS -pthread -o "$OUT/libtapi.so"
+
+rm -f "$OUT/libtapi.a"
+$AR rcs "$OUT/libtapi.a" "$OUT/tapi-static.o"
+
+$CXX -O2 -std=c++14 -Iinclude dump/dump.cpp "$OUT/libtapi.a" \
+  $YAML_LIBS -pthread -o "$OUT/tapi-dump"
@@ -0,0 +1,317 @@
+// Utility that compares two trees of TBD files, for example two versions of
+// an SDK, and prints the differences in their linker interfaces for each
+// architecture: added and removed exports, changes to whether an export is
+// weak, and changes to the install name, versions, and re-exported
+// libraries.
+//
+// Usage: tapi-diff OLD_DIR NEW_DIR
+//
+// The exit status is 0 if there are no differences, 1 if there are, and 2
+// if there was an error.
+
+#include <tapi/tapi.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace tapi;
+
+// From Apple's mach/machine.h
+#define CPU_ARCH_ABI64 0x1000000
+#define CPU_TYPE_I386 ((cpu_type_t)7)
+#define CPU_TYPE_X86_64 ((cpu_type_t)(CPU_TYPE_I386 | CPU_ARCH_ABI64))
+#define CPU_SUBTYPE_I386_ALL ((cpu_subtype_t)3)
+#define CPU_SUBTYPE_X86_64_ALL CPU_SUBTYPE_I386_ALL
+#define CPU_SUBTYPE_X86_64_H ((cpu_subtype_t)8)
+
+struct Arch
+{
+  const char * name;
+  cpu_type_t cpuType;
+  cpu_subtype_t cpuSubType;
+};
+
+static const Arch archs[] = {
+  { "x86_64", CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL },
+  { "x86_64h", CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_H },
+  { "i386", CPU_TYPE_I386, CPU_SUBTYPE_I386_ALL },
+};
+
+// How many files from each tree we load at once.  Each file is parsed once
+// for all the architectures, so this limits how much is in memory.
+static const size_t filesPerBatch = 256;
+
+static std::ostream & operator << (std::ostream & os, const PackedVersion32 & v)
+{
+  os << v.getMajor() << '.' << v.getMinor() << '.' << v.getPatch();
+  return os;
+}
+
+static bool endsWith(const std::string & str, const char * suffix)
+{
+  size_t length = strlen(suffix);
+  return str.size() >= length &&
+    str.compare(str.size() - length, length, suffix) == 0;
+}
+
+// Adds the paths of all the TBD files under root to the list, relative to
+// root.
+static void findStubs(const std::string & root, const std::string & relative,
+  std::vector<std::string> & list)
+{
+  std::string dirPath = relative.empty() ? root : root + "/" + relative;
+  DIR * dir = opendir(dirPath.c_str());
+  if (dir == NULL)
+  {
+    std::cerr << "Error: " << dirPath << ": " << strerror(errno) << std::endl;
+    exit(2);
+  }
+
+  while (struct dirent * entry = readdir(dir))
+  {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") { continue; }
+    std::string child = relative.empty() ? name : relative + "/" + name;
+
+    // Use lstat so that symbolic links to directories (common in SDK
+    // frameworks) don't make us visit the same files twice.
+    struct stat st;
+    if (lstat((root + "/" + child).c_str(), &st)) { continue; }
+    if (S_ISDIR(st.st_mode))
+    {
+      findStubs(root, child, list);
+    }
+    else if (S_ISREG(st.st_mode) && endsWith(name, ".tbd"))
+    {
+      list.push_back(child);
+    }
+  }
+  closedir(dir);
+}
+
+template <typename T>
+static void compareField(std::ostream & out, const char * arch,
+  const char * field, const T & oldValue, const T & newValue)
+{
+  if (oldValue == newValue) { return; }
+  out << arch << ": " << field << ": "
+    << oldValue << " -> " << newValue << '\n';
+}
+
+static void compareReexports(std::ostream & out, const char * arch,
+  const LinkerInterfaceFile & oldFile, const LinkerInterfaceFile & newFile)
+{
+  std::vector<std::string> a = oldFile.reexportedLibraries();
+  std::vector<std::string> b = newFile.reexportedLibraries();
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+
+  auto i = a.begin(), j = b.begin();
+  while (i != a.end() || j != b.end())
+  {
+    if (j == b.end() || (i != a.end() && *i < *j))
+    {
+      out << arch << ": - reexport " << *i++ << '\n';
+    }
+    else if (i == a.end() || *j < *i)
+    {
+      out << arch << ": + reexport " << *j++ << '\n';
+    }
+    else
+    {
+      ++i;
+      ++j;
+    }
+  }
+}
+
+// The files must have sorted symbols.
+static void compareExports(std::ostream & out, const char * arch,
+  const LinkerInterfaceFile & oldFile, const LinkerInterfaceFile & newFile)
+{
+  const std::vector<Symbol> & a = oldFile.exports();
+  const std::vector<Symbol> & b = newFile.exports();
+
+  auto i = a.begin(), j = b.begin();
+  while (i != a.end() || j != b.end())
+  {
+    if (j == b.end() || (i != a.end() && i->getName() < j->getName()))
+    {
+      out << arch << ": - " << (i++)->getName() << '\n';
+    }
+    else if (i == a.end() || j->getName() < i->getName())
+    {
+      out << arch << ": + " << (j++)->getName() << '\n';
+    }
+    else
+    {
+      if (i->isWeakDefined() != j->isWeakDefined())
+      {
+        out << arch << ": ~ " << j->getName()
+          << (j->isWeakDefined() ? " (now weak)" : " (no longer weak)")
+          << '\n';
+      }
+      ++i;
+      ++j;
+    }
+  }
+}
+
+static void compare(std::ostream & out, const char * arch,
+  const BatchLoadResult & oldResult, const BatchLoadResult & newResult)
+{
+  const LinkerInterfaceFile * oldFile = oldResult.file;
+  const LinkerInterfaceFile * newFile = newResult.file;
+
+  if (oldFile == NULL && newFile == NULL) { return; }
+  if (oldFile == NULL || newFile == NULL)
+  {
+    const std::string & error = oldFile ? newResult.errorMessage :
+      oldResult.errorMessage;
+    out << arch << ": " << (oldFile ? "removed" : "added")
+      << " (" << error << ")\n";
+    return;
+  }
+
+  compareField(out, arch, "install-name",
+    oldFile->getInstallName(), newFile->getInstallName());
+  compareField(out, arch, "version",
+    oldFile->getCurrentVersion(), newFile->getCurrentVersion());
+  compareField(out, arch, "compat-version",
+    oldFile->getCompatibilityVersion(), newFile->getCompatibilityVersion());
+  compareReexports(out, arch, *oldFile, *newFile);
+  compareExports(out, arch, *oldFile, *newFile);
+}
+
+int main(int argc, char ** argv)
+{
+  if (argc != 3)
+  {
+    std::cerr << "Usage: tapi-diff OLD_DIR NEW_DIR" << std::endl;
+    return 2;
+  }
+  std::string oldRoot = argv[1];
+  std::string newRoot = argv[2];
+
+  std::vector<std::string> oldList, newList;
+  findStubs(oldRoot, "", oldList);
+  findStubs(newRoot, "", newList);
+  std::sort(oldList.begin(), oldList.end());
+  std::sort(newList.begin(), newList.end());
+
+  // Merge the two sorted lists.  Each file gets a report, which we print
+  // at the end so that the output is in order.
+  std::vector<std::string> files;
+  std::vector<std::ostringstream> reports;
+  std::vector<size_t> common;
+  auto i = oldList.begin(), j = newList.begin();
+  while (i != oldList.end() || j != newList.end())
+  {
+    reports.emplace_back();
+    if (j == newList.end() || (i != oldList.end() && *i < *j))
+    {
+      files.push_back(*i++);
+      reports.back() << "removed\n";
+    }
+    else if (i == oldList.end() || *j < *i)
+    {
+      files.push_back(*j++);
+      reports.back() << "added\n";
+    }
+    else
+    {
+      common.push_back(files.size());
+      files.push_back(*i);
+      ++i;
+      ++j;
+    }
+  }
+
+  // Load both versions of the files in batches, so that they are read and
+  // parsed in parallel.
+  std::vector<BatchArch> batchArchs;
+  for (const Arch & arch : archs)
+  {
+    batchArchs.push_back({ arch.cpuType, arch.cpuSubType });
+  }
+
+  PackedVersion32 minOSVersion(10, 11, 0);
+  bool anyErrors = false;
+  for (size_t start = 0; start < common.size(); start += filesPerBatch)
+  {
+    size_t end = std::min(common.size(), start + filesPerBatch);
+    std::vector<std::string> paths;
+    for (size_t k = start; k < end; k++)
+    {
+      paths.push_back(oldRoot + "/" + files[common[k]]);
+      paths.push_back(newRoot + "/" + files[common[k]]);
+    }
+
+    std::vector<MultiArchLoadResult> results =
+      LinkerInterfaceFile::createBatch(paths, batchArchs,
+        CpuSubTypeMatching::Exact, minOSVersion);
+
+    for (size_t k = start; k < end; k++)
+    {
+      std::ostringstream & report = reports[common[k]];
+      MultiArchLoadResult & oldResult = results[2 * (k - start)];
+      MultiArchLoadResult & newResult = results[2 * (k - start) + 1];
+
+      // A file that fails to load is an error, not a difference.
+      bool failed = false;
+      for (const MultiArchLoadResult * result : { &oldResult, &newResult })
+      {
+        if (result->errorMessage.empty()) { continue; }
+        std::cerr << "Error: " << result->path << ": "
+          << result->errorMessage << std::endl;
+        failed = true;
+      }
+      if (failed)
+      {
+        anyErrors = true;
+      }
+      else
+      {
+        for (size_t a = 0; a < batchArchs.size(); a++)
+        {
+          for (MultiArchLoadResult * result : { &oldResult, &newResult })
+          {
+            LinkerInterfaceFile * file = result->archs[a].file;
+            if (file) { file->sortSymbols(); }
+          }
+          compare(report, archs[a].name, oldResult.archs[a],
+            newResult.archs[a]);
+        }
+      }
+
+      for (MultiArchLoadResult * result : { &oldResult, &newResult })
+      {
+        for (BatchLoadResult & archResult : result->archs)
+        {
+          delete archResult.file;
+        }
+      }
+    }
+  }
+
+  bool anyDifferences = false;
+  for (size_t k = 0; k < files.size(); k++)
+  {
+    std::string report = reports[k].str();
+    if (report.empty()) { continue; }
+    std::cout << "--- " << files[k] << '\n' << report;
+    anyDifferences = true;
+  }
+
+  if (anyErrors) { return 2; }
+  return anyDifferences ? 1 : 0;
+}
@@ -5,10 +5,13 @@
 #include <tapi/tapi.h>
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <new>
+#include <atomic>
 
 using namespace tapi;
 
@@ -20,6 +23,60 @@ using namespace tapi;
 #define CPU_SUBTYPE_X86_64_ALL CPU_SUBTYPE_I386_ALL
 #define CPU_SUBTYPE_X86_64_H ((cpu_subtype_t)8)
 
+// Allocation tracking for --memory-stats.  We replace the global operator
+// new and delete and keep the size of each block in a small header.  The
+// size is only recorded, and the counters only updated, when the option is
+// on; blocks allocated before that have a size of 0.  The counters are
+// atomic because the library may use threads.
+static bool memoryStats = false;
+static bool sortedSymbols = false;
+static std::atomic<size_t> allocationCount(0);
+static std::atomic<size_t> currentBytes(0);
+static std::atomic<size_t> peakBytes(0);
+static const size_t allocationHeaderSize = 16;
+
+void * operator new(size_t size)
+{
+  char * p = (char *)malloc(size + allocationHeaderSize);
+  if (p == NULL) { throw std::bad_alloc(); }
+  *(size_t *)p = 0;
+  if (memoryStats)
+  {
+    *(size_t *)p = size;
+    allocationCount++;
+    size_t bytes = currentBytes += size;
+    size_t peak = peakBytes;
+    while (bytes > peak && !peakBytes.compare_exchange_weak(peak, bytes)) { }
+  }
+  return p + allocationHeaderSize;
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  try
+  {
+    return operator new(size);
+  }
+  catch (const std::bad_alloc &)
+  {
+    return NULL;
+  }
+}
+
+void operator delete(void * ptr) noexcept
+{
+  if (ptr == NULL) { return; }
+  char * p = (char *)ptr - allocationHeaderSize;
+  size_t size = *(size_t *)p;
+  if (size) { currentBytes -= size; }
+  free(p);
+}
+
+void operator delete(void * ptr, size_t) noexcept
+{
+  operator delete(ptr);
+}
+
 static std::ostream & operator << (std::ostream & os, const PackedVersion32 & v)
 {
   os << v.getMajor() << '.' << v.getMinor() << '.' << v.getPatch();
@@ -71,10 +128,17 @@ static void dump(const std::string & filename,
 
   std::string errorMessage;
 
+  size_t startCount = allocationCount;
+  size_t startBytes = currentBytes;
+  peakBytes = startBytes;
+
   LinkerInterfaceFile * file = LinkerInterfaceFile::create(filename,
     data.data(), data.size(), cpuType, cpuSubType,
     CpuSubTypeMatching::Exact, minOSVersion, errorMessage);
 
+  size_t createCount = allocationCount - startCount;
+  size_t createPeakBytes = peakBytes - startBytes;
+
   if (errorMessage.size())
   {
     std::cout << "Failed to parse: " << errorMessage << std::endl;
@@ -93,6 +157,13 @@ static void dump(const std::string & filename,
     exit(1);
   }
 
+#ifdef TINYTAPI
+  if (sortedSymbols)
+  {
+    file->sortSymbols();
+  }
+#endif
+
   std::cout << "install-name: " << file->getInstallName();
   if (file->isInstallNameVersionSpecific())
   {
@@ -153,6 +224,15 @@ static void dump(const std::string & filename,
     dumpSymbol(sym);
   }
 
+  if (memoryStats)
+  {
+    std::cout << "allocations: " << createCount << std::endl;
+    std::cout << "peak-bytes: " << createPeakBytes << std::endl;
+#ifdef TINYTAPI
+    std::cout << "interface-bytes: " << file->memoryUsage() << std::endl;
+#endif
+  }
+
   std::cout << std::endl;
 
   delete file;
@@ -178,6 +258,16 @@ int main(int argc, char ** argv)
   std::cout << std::endl;
   for (int i = 1; i < argc; i++)
   {
+    if (!strcmp(argv[i], "--memory-stats"))
+    {
+      memoryStats = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--sorted"))
+    {
+      sortedSymbols = true;
+      continue;
+    }
     dumpAsEveryArch(argv[i]);
   }
 }
@@ -8,6 +8,14 @@
 #define TAPI_API_VERSION_MINOR 2U
 #define TAPI_API_VERSION_PATCH 0U
 
+// Defined so that programs can use the TinyTAPI extensions to the API
+// while still building against Apple's libtapi.
+#define TINYTAPI 1
+
+// Marks the public API, so that everything else can be hidden when the
+// library is built with -fvisibility=hidden.
+#define TAPI_PUBLIC __attribute__((visibility("default")))
+
 using cpu_type_t = int;
 using cpu_subtype_t = int;
 
@@ -16,18 +24,68 @@ namespace tapi {
 // Internally used class; ideally this wouldn't even be here.
 struct StubData;
 
-class APIVersion {
+// Interface for the allocators used for the library's internal data
+// structures.  Implementations must be thread-safe if the library is used
+// from more than one thread.
+class TAPI_PUBLIC Allocator {
+public:
+  virtual ~Allocator() = default;
+  virtual void * allocate(size_t size) = 0;
+  virtual void deallocate(void * p, size_t size) noexcept = 0;
+};
+
+// Creates one of the allocators that come with the library.  The arena
+// allocator hands out memory from large chunks and only frees it when the
+// allocator is deleted.  The pool allocator also reuses freed blocks of
+// small sizes.  Returns nullptr if out of memory.
+TAPI_PUBLIC Allocator * createArenaAllocator(
+  size_t chunkSize = 64 * 1024) noexcept;
+TAPI_PUBLIC Allocator * createPoolAllocator(
+  size_t chunkSize = 64 * 1024) noexcept;
+
+// Sets the allocator used for data structures created from now on.
+// Passing nullptr restores the default allocator, which uses malloc.
+// The allocator must outlive everything allocated from it.
+TAPI_PUBLIC void setAllocator(Allocator *) noexcept;
+TAPI_PUBLIC Allocator & getAllocator() noexcept;
+
+// Limits on the resources used to parse a TBD file.  With these limits,
+// parsing takes time and memory linear in the size of the input.  Files
+// that exceed them fail to load with an error message.
+struct ParseLimits {
+  size_t maxInputSize = 256 * 1024 * 1024;
+
+  // Maximum number of YAML nodes, where each alias counts as the number of
+  // nodes it refers to.
+  size_t maxNodeCount = 16 * 1024 * 1024;
+
+  // Maximum nesting depth of sequences and mappings.
+  size_t maxDepth = 64;
+
+  size_t maxAliasCount = 1024;
+};
+
+TAPI_PUBLIC void setParseLimits(const ParseLimits &) noexcept;
+TAPI_PUBLIC ParseLimits getParseLimits() noexcept;
+
+// Returns the hash of a file's contents that is recorded with each call
+// when create calls are traced (see src/trace.h).  tapi-replay uses it to
+// tell whether a file has changed since the trace was recorded.
+TAPI_PUBLIC uint64_t traceContentHash(const uint8_t * data, size_t size)
+  noexcept;
+
+class TAPI_PUBLIC APIVersion {
 public:
   static unsigned getMajor() noexcept;
 };
 
-class Version {
+class TAPI_PUBLIC Version {
 public:
   static std::string getFullVersionAsString() noexcept;
   static std::string getAsString() noexcept;
 };
 
-class PackedVersion32 {
+class TAPI_PUBLIC PackedVersion32 {
   uint32_t version = 0;
 public:
   PackedVersion32() = default;
@@ -68,18 +126,89 @@ enum class CpuSubTypeMatching : unsigned {
   Exact = 1,
 };
 
-class Symbol {
+enum class SymbolKind : unsigned {
+  GlobalSymbol = 0,
+  ObjectiveCClass = 1,
+  ObjectiveCClassEHType = 2,
+  ObjectiveCInstanceVariable = 3,
+};
+
+class TAPI_PUBLIC Symbol {
 public:
   std::string name;
+  SymbolKind kind = SymbolKind::GlobalSymbol;
   bool weak = false;
   bool threadLocal = false;
-  Symbol(const std::string & name) : name(name) { }
+  Symbol(std::string name, SymbolKind kind = SymbolKind::GlobalSymbol)
+    : name(std::move(name)), kind(kind) { }
   const std::string & getName() const noexcept { return name; }
+  SymbolKind getKind() const noexcept { return kind; }
   bool isWeakDefined() const noexcept { return weak; }
   bool isThreadLocalValue() const noexcept { return threadLocal; }
 };
 
-class LinkerInterfaceFile {
+// A contiguous part of a list of symbols.
+class TAPI_PUBLIC SymbolRange {
+  std::vector<Symbol>::const_iterator first, last;
+public:
+  SymbolRange(std::vector<Symbol>::const_iterator first,
+    std::vector<Symbol>::const_iterator last) : first(first), last(last) { }
+  std::vector<Symbol>::const_iterator begin() const noexcept { return first; }
+  std::vector<Symbol>::const_iterator end() const noexcept { return last; }
+  size_t size() const noexcept { return last - first; }
+  bool empty() const noexcept { return first == last; }
+};
+
+// A symbol passed to a SymbolVisitor.  The name is not null-terminated and
+// is only valid until the visitor returns.
+struct SymbolView {
+  const char * name;
+  size_t nameSize;
+  SymbolKind kind;
+  bool weak;
+  bool threadLocal;
+  bool hidden;
+};
+
+// Receives the contents of a file from LinkerInterfaceFile::visitSymbols.
+class TAPI_PUBLIC SymbolVisitor {
+public:
+  virtual ~SymbolVisitor() = default;
+  virtual void visitExport(const SymbolView &) = 0;
+  virtual void visitUndefined(const SymbolView &) { }
+  virtual void visitReexport(const char * name, size_t nameSize)
+  {
+    (void)name;
+    (void)nameSize;
+  }
+};
+
+class LinkerInterfaceFile;
+
+// The outcome of loading one path with LinkerInterfaceFile::createBatch.
+// Exactly one of file and errorMessage is set.  The caller owns file.
+struct BatchLoadResult {
+  std::string path;
+  LinkerInterfaceFile * file = nullptr;
+  std::string errorMessage;
+};
+
+struct BatchArch {
+  cpu_type_t cpuType;
+  cpu_subtype_t cpuSubType;
+};
+
+// The result of loading one file for several architectures.  If the file
+// could not be read or parsed, errorMessage says why and archs is empty.
+// Otherwise archs has a result for each architecture, in the order they
+// were asked for.
+struct MultiArchLoadResult {
+  std::string path;
+  std::string errorMessage;
+  std::vector<BatchLoadResult> archs;
+};
+
+class TAPI_PUBLIC LinkerInterfaceFile {
   LinkerInterfaceFile() = default;
 
   Platform platform = Platform::Unknown;
@@ -90,9 +219,24 @@ class LinkerInterfaceFile {
   bool applicationExtensionSafe = true;
   bool twoLevelNamespace = true;
   std::vector<std::string> reexports, ignoreList;
+  std::vector<uint64_t> exportFilter;
+  bool symbolsSorted = false;
 
   void init(const StubData &, cpu_type_t, cpu_subtype_t,
     CpuSubTypeMatching, PackedVersion32 minOSVersion,
+    const std::vector<std::string> * wantedSymbols,
+    std::string & errorMessage);
+
+  static LinkerInterfaceFile * createImpl(const std::string & path,
+    const uint8_t * data, size_t size, cpu_type_t, cpu_subtype_t,
+    CpuSubTypeMatching, PackedVersion32 minOSVersion,
+    const std::vector<std::string> * wantedSymbols,
+    std::string & errorMessage) noexcept;
+
+  static LinkerInterfaceFile * createFromStubData(const StubData &,
+    cpu_type_t, cpu_subtype_t, CpuSubTypeMatching,
+    PackedVersion32 minOSVersion,
+    const std::vector<std::string> * wantedSymbols,
     std::string & errorMessage);
 
 public:
@@ -102,6 +246,44 @@ public:
     CpuSubTypeMatching, PackedVersion32 minOSVersion,
     std::string & errorMessage) noexcept;
 
+  // Like create, but the resulting file only has the exports whose names
+  // are in wantedSymbols (hidden ones go in ignoreExports) and no
+  // undefineds.  This is cheaper than create when the caller is only
+  // resolving a few symbols, but the whole file is still parsed and every
+  // hide command's name is still copied, so the cost grows with the size of
+  // the file rather than the number of wanted symbols.
+  static LinkerInterfaceFile * createForSymbols(const std::string & path,
+    const uint8_t * data, size_t size, cpu_type_t, cpu_subtype_t,
+    CpuSubTypeMatching, PackedVersion32 minOSVersion,
+    const std::vector<std::string> & wantedSymbols,
+    std::string & errorMessage) noexcept;
+
+  // Passes the symbols for the selected architecture straight to the
+  // visitor, without creating a LinkerInterfaceFile.  The exports and
+  // undefineds are visited in the same order as exports() and undefineds()
+  // would have them, followed by the re-exported libraries.  Exports that
+  // create would have moved to ignoreExports() are visited with hidden set.
+  // Returns false, without visiting anything, if there is an error.
+  static bool visitSymbols(const std::string & path,
+    const uint8_t * data, size_t size, cpu_type_t, cpu_subtype_t,
+    CpuSubTypeMatching, PackedVersion32 minOSVersion,
+    SymbolVisitor & visitor, std::string & errorMessage) noexcept;
+
+  // Reads and parses many files at once.  The files are read with io_uring
+  // where the kernel supports it, and parsed on a pool of threads while
+  // other files are still being read.  The results are in the same order
+  // as paths.
+  static std::vector<BatchLoadResult> createBatch(
+    const std::vector<std::string> & paths, cpu_type_t, cpu_subtype_t,
+    CpuSubTypeMatching, PackedVersion32 minOSVersion) noexcept;
+
+  // Like createBatch, but loads each file for several architectures.  A
+  // TBD file is only parsed once, however many architectures there are.
+  static std::vector<MultiArchLoadResult> createBatch(
+    const std::vector<std::string> & paths,
+    const std::vector<BatchArch> & archs,
+    CpuSubTypeMatching, PackedVersion32 minOSVersion) noexcept;
+
   static bool isSupported(const std::string & path,
     const uint8_t * data, size_t size) noexcept;
 
@@ -206,6 +388,33 @@ public:
   {
     return undefinedList;
   }
+
+  // Sorts exports() and undefineds() by name (comparing bytes, like
+  // strcmp) and removes duplicates, which occur when several sections of a
+  // TBD file cover the same architecture.  A symbol that appears more than
+  // once is weak only if every copy is weak, and thread-local if any copy
+  // is.
+  void sortSymbols() noexcept;
+
+  bool hasSortedSymbols() const noexcept
+  {
+    return symbolsSorted;
+  }
+
+  // Returns the exports whose names start with prefix, for example
+  // "_OBJC_CLASS_$_".  This is a binary search, so it calls sortSymbols
+  // first if it hasn't been called yet.
+  SymbolRange exportsWithPrefix(const std::string & prefix) noexcept;
+
+  // Returns false if the name is definitely not in exports().  Returns true
+  // if it might be, in which case the caller should search exports().
+  // This is answered by a small Bloom filter, so most misses never touch
+  // the export list.
+  bool mayExport(const std::string & name) const noexcept;
+
+  // Returns the number of bytes of heap memory owned by this object,
+  // including the object itself.
+  size_t memoryUsage() const noexcept;
 };
 
 }  // end namespace tapi
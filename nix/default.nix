@@ -79,6 +79,20 @@ rec {
     native_inputs = [ tinytapi ];
   };
 
+  tinytapi_diff = native.make_derivation rec {
+    name = "tinytapi-diff";
+    builder = ./diff_builder.sh;
+    src = ../diff;
+    native_inputs = [ tinytapi ];
+  };
+
+  tinytapi_replay = native.make_derivation rec {
+    name = "tinytapi-replay";
+    builder = ./replay_builder.sh;
+    src = ../replay;
+    native_inputs = [ tinytapi ];
+  };
+
   test = native.make_derivation rec {
     name = "tinytapi-test";
     builder = ./test.sh;
@@ -0,0 +1,7 @@
+source $setup
+
+CFLAGS="-g -O2 -std=c++14 -Wall -Wextra"
+g++ $CFLAGS $src/replay.cpp $(pkg-config --cflags --libs libtapi)
+
+mkdir -p $out/bin
+cp a.out $out/bin/$name
@@ -16,7 +16,7 @@ libdir=\${prefix}/lib
 includedir=\${prefix}/include
 
 Version: 2.0.0
-Libs: -L\${libdir} -ltapi
+Libs: -L\${libdir} -ltapi -pthread
 Cflags: -I\${includedir}
 Requires: yaml-0.1
 EOF
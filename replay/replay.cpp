@@ -0,0 +1,216 @@
+// Utility that replays a trace of LinkerInterfaceFile::create calls
+// recorded with the TINYTAPI_TRACE environment variable (see src/trace.h)
+// and reports how long they take.  This lets us measure changes to the
+// library against a real workload instead of a synthetic one.
+//
+// Usage: tapi-replay [--threads N] [--repeat N] TRACE
+//
+// All the files named in the trace are read into memory first, so the
+// timing does not include disk I/O.  With --threads, the calls are shared
+// among several threads, which shows how well the library scales when a
+// linker loads many files at once.
+
+#include <tapi/tapi.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tapi;
+
+struct TraceEntry
+{
+  uint64_t hash;
+  cpu_type_t cpuType;
+  cpu_subtype_t cpuSubType;
+  CpuSubTypeMatching matchingMode;
+  PackedVersion32 minOSVersion;
+  uint64_t nanoseconds;
+  std::string path;
+  const std::vector<uint8_t> * data;
+};
+
+static std::vector<TraceEntry> readTrace(const char * filename)
+{
+  std::ifstream stream(filename);
+  if (!stream)
+  {
+    std::cerr << "Error: " << filename << ": " << strerror(errno) << std::endl;
+    exit(1);
+  }
+
+  std::vector<TraceEntry> entries;
+  std::string line;
+  size_t lineNumber = 0;
+  while (std::getline(stream, line))
+  {
+    lineNumber++;
+    std::istringstream fields(line);
+    TraceEntry entry;
+    unsigned matching, minOSVersion;
+    fields >> std::hex >> entry.hash >> std::dec >> entry.cpuType
+      >> entry.cpuSubType >> matching >> minOSVersion >> entry.nanoseconds;
+    if (!fields || fields.get() != '\t' || !std::getline(fields, entry.path))
+    {
+      std::cerr << "Error: " << filename << ":" << lineNumber
+        << ": invalid trace entry." << std::endl;
+      exit(1);
+    }
+    entry.matchingMode = (CpuSubTypeMatching)matching;
+    entry.minOSVersion = minOSVersion;
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+// Reads each file in the trace once, and warns about files that are
+// different from when the trace was recorded.
+static void loadFiles(std::vector<TraceEntry> & entries,
+  std::map<std::string, std::vector<uint8_t>> & files)
+{
+  for (TraceEntry & entry : entries)
+  {
+    auto it = files.find(entry.path);
+    if (it == files.end())
+    {
+      std::ifstream stream(entry.path, std::ios::binary);
+      std::vector<uint8_t> data {
+        std::istreambuf_iterator<char>(stream),
+        std::istreambuf_iterator<char>()
+      };
+      if (!stream)
+      {
+        std::cerr << "Warning: could not read " << entry.path << std::endl;
+      }
+      it = files.emplace(entry.path, std::move(data)).first;
+      const std::vector<uint8_t> & contents = it->second;
+      if (stream &&
+        traceContentHash(contents.data(), contents.size()) != entry.hash)
+      {
+        std::cerr << "Warning: " << entry.path
+          << " has changed since the trace was recorded" << std::endl;
+      }
+    }
+    entry.data = &it->second;
+  }
+}
+
+static double toMilliseconds(uint64_t nanoseconds)
+{
+  return nanoseconds / 1e6;
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned threadCount = 1;
+  unsigned repeat = 1;
+  const char * traceName = NULL;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+    {
+      threadCount = std::max(1, atoi(argv[++i]));
+    }
+    else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+    {
+      repeat = std::max(1, atoi(argv[++i]));
+    }
+    else if (traceName == NULL)
+    {
+      traceName = argv[i];
+    }
+    else
+    {
+      traceName = NULL;
+      break;
+    }
+  }
+  if (traceName == NULL)
+  {
+    std::cerr << "Usage: tapi-replay [--threads N] [--repeat N] TRACE"
+      << std::endl;
+    return 1;
+  }
+
+  // Don't record the replay into a trace.
+  unsetenv("TINYTAPI_TRACE");
+
+  std::vector<TraceEntry> entries = readTrace(traceName);
+  std::map<std::string, std::vector<uint8_t>> files;
+  loadFiles(entries, files);
+
+  size_t callCount = entries.size() * repeat;
+  std::vector<uint64_t> durations(callCount);
+  std::atomic<size_t> nextCall(0);
+  std::atomic<size_t> failureCount(0);
+
+  auto work = [&]()
+  {
+    size_t i;
+    while ((i = nextCall++) < callCount)
+    {
+      const TraceEntry & entry = entries[i % entries.size()];
+      std::string errorMessage;
+      auto start = std::chrono::steady_clock::now();
+      LinkerInterfaceFile * file = LinkerInterfaceFile::create(entry.path,
+        entry.data->data(), entry.data->size(), entry.cpuType,
+        entry.cpuSubType, entry.matchingMode, entry.minOSVersion,
+        errorMessage);
+      delete file;
+      auto duration = std::chrono::steady_clock::now() - start;
+      durations[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        duration).count();
+      if (file == NULL) { failureCount++; }
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < threadCount; i++) { threads.emplace_back(work); }
+  work();
+  for (std::thread & thread : threads) { thread.join(); }
+  uint64_t wallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+
+  uint64_t recordedTime = 0;
+  for (const TraceEntry & entry : entries)
+  {
+    recordedTime += entry.nanoseconds;
+  }
+
+  uint64_t replayTime = 0;
+  for (uint64_t d : durations) { replayTime += d; }
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "calls: " << callCount << std::endl;
+  std::cout << "files: " << files.size() << std::endl;
+  std::cout << "threads: " << threadCount << std::endl;
+  std::cout << "failures: " << failureCount << std::endl;
+  std::cout << "wall-ms: " << toMilliseconds(wallTime) << std::endl;
+  std::cout << "replay-ms: " << toMilliseconds(replayTime) << std::endl;
+  std::cout << "recorded-ms: " << toMilliseconds(recordedTime * repeat)
+    << std::endl;
+
+  if (callCount)
+  {
+    std::sort(durations.begin(), durations.end());
+    std::cout << "mean-us: " << replayTime / callCount / 1e3 << std::endl;
+    std::cout << "p50-us: " << durations[callCount / 2] / 1e3 << std::endl;
+    std::cout << "p99-us: " << durations[callCount * 99 / 100] / 1e3
+      << std::endl;
+    std::cout << "max-us: " << durations.back() / 1e3 << std::endl;
+  }
+}
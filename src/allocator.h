@@ -0,0 +1,234 @@
+// Allocators for the internal data structures of this library.
+
+class MallocAllocator : public Allocator
+{
+public:
+  void * allocate(size_t size) override
+  {
+    void * p = malloc(size ? size : 1);
+    if (p == nullptr) { throw std::bad_alloc(); }
+    return p;
+  }
+
+  void deallocate(void * p, size_t size) noexcept override
+  {
+    (void)size;
+    free(p);
+  }
+};
+
+static MallocAllocator mallocAllocator;
+static std::atomic<Allocator *> currentAllocator(&mallocAllocator);
+
+void tapi::setAllocator(Allocator * allocator) noexcept
+{
+  currentAllocator = allocator ? allocator : &mallocAllocator;
+}
+
+Allocator & tapi::getAllocator() noexcept
+{
+  return *currentAllocator;
+}
+
+// An allocator that hands out memory from large chunks by bumping a
+// pointer.  deallocate() does nothing; all the memory is freed when reset()
+// is called or the allocator is destroyed.
+class ArenaAllocator : public Allocator
+{
+  std::mutex mutex;
+  std::vector<void *> chunks;
+  char * current = nullptr;
+  char * end = nullptr;
+  size_t chunkSize;
+  size_t used = 0, reserved = 0;
+
+public:
+  explicit ArenaAllocator(size_t chunkSize);
+  ~ArenaAllocator();
+  ArenaAllocator(const ArenaAllocator &) = delete;
+  ArenaAllocator & operator=(const ArenaAllocator &) = delete;
+  void * allocate(size_t size) override;
+  void deallocate(void * p, size_t size) noexcept override;
+  void reset() noexcept;
+  size_t bytesAllocated() const noexcept { return used; }
+  size_t bytesReserved() const noexcept { return reserved; }
+};
+
+// An allocator that keeps a free list for each small size class so that
+// freed blocks get reused, with the blocks themselves coming from an arena.
+// Large blocks go directly to malloc.
+class PoolAllocator : public Allocator
+{
+  static const size_t granularity = 16;
+  static const size_t classCount = 16;
+  std::mutex mutex;
+  ArenaAllocator arena;
+  void * freeLists[classCount] = {};
+
+public:
+  explicit PoolAllocator(size_t chunkSize) : arena(chunkSize) {}
+  void * allocate(size_t size) override;
+  void deallocate(void * p, size_t size) noexcept override;
+  size_t bytesReserved() const noexcept { return arena.bytesReserved(); }
+};
+
+Allocator * tapi::createArenaAllocator(size_t chunkSize) noexcept
+{
+  return new (std::nothrow) ArenaAllocator(chunkSize);
+}
+
+Allocator * tapi::createPoolAllocator(size_t chunkSize) noexcept
+{
+  return new (std::nothrow) PoolAllocator(chunkSize);
+}
+
+static const size_t allocationAlignment = 16;
+
+static size_t alignSize(size_t size)
+{
+  return (size + allocationAlignment - 1) & ~(allocationAlignment - 1);
+}
+
+ArenaAllocator::ArenaAllocator(size_t chunkSize) : chunkSize(chunkSize)
+{
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+  reset();
+}
+
+void * ArenaAllocator::allocate(size_t size)
+{
+  size = alignSize(size ? size : 1);
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (size > (size_t)(end - current))
+  {
+    // Big blocks get their own chunk so we don't waste the rest of the
+    // current one.
+    bool dedicated = size > chunkSize / 4;
+    size_t newSize = dedicated ? size : chunkSize;
+    chunks.reserve(chunks.size() + 1);  // So push_back can't throw.
+    char * chunk = (char *)malloc(newSize);
+    if (chunk == nullptr) { throw std::bad_alloc(); }
+    chunks.push_back(chunk);
+    reserved += newSize;
+    used += size;
+    if (dedicated) { return chunk; }
+    current = chunk;
+    end = chunk + newSize;
+  }
+  else
+  {
+    used += size;
+  }
+
+  void * p = current;
+  current += size;
+  return p;
+}
+
+void ArenaAllocator::deallocate(void * p, size_t size) noexcept
+{
+  (void)p;
+  (void)size;
+}
+
+void ArenaAllocator::reset() noexcept
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (void * chunk : chunks) { free(chunk); }
+  chunks.clear();
+  current = end = nullptr;
+  used = reserved = 0;
+}
+
+void * PoolAllocator::allocate(size_t size)
+{
+  size = alignSize(size ? size : 1);
+  size_t index = size / granularity - 1;
+  if (index >= classCount)
+  {
+    void * p = malloc(size);
+    if (p == nullptr) { throw std::bad_alloc(); }
+    return p;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    void * p = freeLists[index];
+    if (p != nullptr)
+    {
+      freeLists[index] = *(void **)p;
+      return p;
+    }
+  }
+  return arena.allocate(size);
+}
+
+void PoolAllocator::deallocate(void * p, size_t size) noexcept
+{
+  if (p == nullptr) { return; }
+  size = alignSize(size ? size : 1);
+  size_t index = size / granularity - 1;
+  if (index >= classCount)
+  {
+    free(p);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  *(void **)p = freeLists[index];
+  freeLists[index] = p;
+}
+
+// Standard library allocator that uses the allocator that was current
+// when it was constructed, so that containers free their memory with the
+// same allocator even if setAllocator is called in the meantime.
+template <typename T>
+struct StubAllocator
+{
+  using value_type = T;
+
+  Allocator * allocator;
+
+  StubAllocator() noexcept : allocator(&getAllocator()) {}
+
+  template <typename U>
+  StubAllocator(const StubAllocator<U> & other) noexcept
+    : allocator(other.allocator) {}
+
+  T * allocate(size_t n)
+  {
+    return (T *)allocator->allocate(n * sizeof(T));
+  }
+
+  void deallocate(T * p, size_t n) noexcept
+  {
+    allocator->deallocate(p, n * sizeof(T));
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const StubAllocator<T> & a, const StubAllocator<U> & b)
+{
+  return a.allocator == b.allocator;
+}
+
+template <typename T, typename U>
+bool operator!=(const StubAllocator<T> & a, const StubAllocator<U> & b)
+{
+  return a.allocator != b.allocator;
+}
+
+using StubString = std::basic_string<char, std::char_traits<char>,
+  StubAllocator<char>>;
+
+template <typename T>
+using StubVector = std::vector<T, StubAllocator<T>>;
+
+static std::string toStdString(const StubString & str)
+{
+  return std::string(str.data(), str.size());
+}
@@ -76,8 +76,9 @@ static Architecture getArchByName(const std::string & name)
   return Architecture::None;
 }
 
+template <typename ArchList>
 static Architecture pickArchitecture(Architecture arch,
-  bool enforceCpuSubType, const std::vector<Architecture> & list)
+  bool enforceCpuSubType, const ArchList & list)
 {
   for (Architecture a : list)
   {
@@ -0,0 +1,459 @@
+// Loading many files at once: the disk I/O is done with io_uring where it
+// is available, and the parsing is done on a pool of threads, so that
+// reading one file overlaps with parsing others.
+
+// We need IORING_OP_OPENAT and IORING_OP_READ, from Linux 5.6.  They are
+// enumerators, which the preprocessor can't see, so we check for
+// IORING_FEAT_RW_CUR_POS, which was added along with them.
+#if defined(__linux__) && defined(__NR_io_uring_setup) && \
+  defined(__NR_io_uring_enter) && defined(IORING_FEAT_RW_CUR_POS)
+#define TAPI_HAVE_IO_URING
+#endif
+
+// The state of one file in a batch.
+struct BatchFile
+{
+  const std::string * path;
+  std::vector<uint8_t> data;
+  int fd = -1;
+  size_t size = 0;
+
+  // True if data holds the whole file; otherwise the parsing thread needs
+  // to read it first.
+  bool loaded = false;
+};
+
+// Queue of indices of files that are ready to be parsed.  It also limits
+// how many files have been read but not parsed, so that we don't read the
+// whole batch into memory when parsing is the bottleneck.
+class BatchQueue
+{
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<size_t> ready;
+  size_t buffered = 0;
+  bool closed = false;
+
+public:
+  void push(size_t index, bool loaded)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.push_back(index);
+    if (loaded) { buffered++; }
+    changed.notify_all();
+  }
+
+  // Returns false when the queue is closed and empty.
+  bool pop(size_t & index)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return ready.size() || closed; });
+    if (ready.empty()) { return false; }
+    index = ready.front();
+    ready.pop_front();
+    return true;
+  }
+
+  void doneWithBuffer()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    buffered--;
+    changed.notify_all();
+  }
+
+  void waitForRoom(size_t limit)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return buffered < limit; });
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    changed.notify_all();
+  }
+};
+
+static bool readWholeFile(BatchFile & file, std::string & error)
+{
+  int fd = open(file.path->c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    error = "Failed to open " + *file.path + ": " + strerror(errno) + ".";
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st))
+  {
+    error = "Failed to read " + *file.path + ": " + strerror(errno) + ".";
+    close(fd);
+    return false;
+  }
+
+  file.data.resize(st.st_size);
+  size_t offset = 0;
+  while (offset < file.data.size())
+  {
+    ssize_t r = read(fd, file.data.data() + offset,
+      file.data.size() - offset);
+    if (r < 0 && errno == EINTR) { continue; }
+    if (r < 0)
+    {
+      error = "Failed to read " + *file.path + ": " + strerror(errno) + ".";
+      close(fd);
+      return false;
+    }
+    if (r == 0) { break; }
+    offset += r;
+  }
+  file.data.resize(offset);
+  close(fd);
+  file.loaded = true;
+  return true;
+}
+
+#ifdef TAPI_HAVE_IO_URING
+
+// A minimal io_uring wrapper using the raw system calls, so we don't
+// depend on liburing.
+class IOURing
+{
+  int ringFd = -1;
+  unsigned entries = 0;
+  void * sqRing = MAP_FAILED;
+  void * cqRing = MAP_FAILED;
+  size_t sqRingSize = 0, cqRingSize = 0;
+  io_uring_sqe * sqes = (io_uring_sqe *)MAP_FAILED;
+  size_t sqesSize = 0;
+  unsigned * sqHead, * sqTail, * sqMask, * sqArray;
+  unsigned * cqHead, * cqTail, * cqMask;
+  io_uring_cqe * cqes;
+  unsigned localTail = 0, submittedTail = 0;
+
+public:
+  IOURing() = default;
+  IOURing(const IOURing &) = delete;
+  IOURing & operator=(const IOURing &) = delete;
+
+  ~IOURing()
+  {
+    if (sqes != MAP_FAILED) { munmap(sqes, sqesSize); }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) { munmap(cqRing, cqRingSize); }
+    if (sqRing != MAP_FAILED) { munmap(sqRing, sqRingSize); }
+    if (ringFd != -1) { close(ringFd); }
+  }
+
+  bool init(unsigned requestedEntries)
+  {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd = syscall(__NR_io_uring_setup, requestedEntries, &p);
+    if (ringFd < 0)
+    {
+      ringFd = -1;
+      return false;
+    }
+    entries = p.sq_entries;
+
+    // Kernels before 5.6 have io_uring, but not the operations we use.
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) { return false; }
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+    {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) { return false; }
+
+    if (singleMap)
+    {
+      cqRing = sqRing;
+    }
+    else
+    {
+      cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+      if (cqRing == MAP_FAILED) { return false; }
+    }
+
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { return false; }
+
+    char * sq = (char *)sqRing;
+    sqHead = (unsigned *)(sq + p.sq_off.head);
+    sqTail = (unsigned *)(sq + p.sq_off.tail);
+    sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    sqArray = (unsigned *)(sq + p.sq_off.array);
+
+    char * cq = (char *)cqRing;
+    cqHead = (unsigned *)(cq + p.cq_off.head);
+    cqTail = (unsigned *)(cq + p.cq_off.tail);
+    cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    localTail = submittedTail = *sqTail;
+    return true;
+  }
+
+  unsigned size() const noexcept { return entries; }
+
+  // Returns a cleared submission queue entry, or nullptr if the queue is
+  // full.
+  io_uring_sqe * getSQE()
+  {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (localTail - head >= entries) { return nullptr; }
+    unsigned index = localTail & *sqMask;
+    sqArray[index] = index;
+    localTail++;
+    memset(&sqes[index], 0, sizeof(io_uring_sqe));
+    return &sqes[index];
+  }
+
+  // Submits the new entries and waits for at least one completion.
+  // Returns the number of entries submitted, or -1 on failure.
+  int submitAndWait()
+  {
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    return enter(localTail - submittedTail, true);
+  }
+
+  // Submits the new entries without waiting.
+  int submit()
+  {
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    return enter(localTail - submittedTail, false);
+  }
+
+  // Waits for at least one completion without submitting anything.
+  bool wait()
+  {
+    return enter(0, true) >= 0;
+  }
+
+  // Takes back the entries that have not been submitted.  Without
+  // SQPOLL, the kernel only reads entries in io_uring_enter, so it will
+  // never see them.
+  void discardUnsubmitted()
+  {
+    localTail = submittedTail;
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+  }
+
+private:
+  int enter(unsigned count, bool wait)
+  {
+    int r;
+    do
+    {
+      r = syscall(__NR_io_uring_enter, ringFd, count, wait ? 1 : 0,
+        wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r > 0) { submittedTail += r; }
+    return r;
+  }
+
+public:
+  template <typename F>
+  void forEachCompletion(F f)
+  {
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+      io_uring_cqe cqe = cqes[head & *cqMask];
+      head++;
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+      f(cqe);
+      tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    }
+  }
+};
+
+// Reads the files with io_uring and pushes each one onto the queue when it
+// is loaded.  Files that io_uring could not handle (for example because the
+// kernel does not support an operation) are pushed without being loaded,
+// and the parsing threads will read them the normal way.  Returns false if
+// io_uring is not available at all, in which case nothing was pushed.
+static bool readFilesWithIOURing(std::vector<BatchFile> & files,
+  BatchQueue & queue, size_t bufferLimit)
+{
+  IOURing ring;
+  if (!ring.init(64)) { return false; }
+
+  enum class Stage { Opening, Reading };
+  const uint64_t cancelRequest = UINT64_MAX;
+  std::vector<Stage> stages(files.size());
+  std::vector<bool> finished(files.size());
+  std::deque<size_t> unsubmitted;
+  size_t next = 0;
+  size_t inFlight = 0;
+
+  auto finish = [&](size_t index, bool loaded)
+  {
+    BatchFile & file = files[index];
+    if (file.fd != -1)
+    {
+      close(file.fd);
+      file.fd = -1;
+    }
+    if (!loaded) { file.data.clear(); }
+    file.loaded = loaded;
+    finished[index] = true;
+    queue.push(index, loaded);
+    inFlight--;
+  };
+
+  // Queues a read of the rest of the file.
+  auto queueRead = [&](size_t index)
+  {
+    BatchFile & file = files[index];
+    io_uring_sqe * sqe = ring.getSQE();
+    if (sqe == nullptr)
+    {
+      finish(index, false);
+      return;
+    }
+    size_t remaining = file.data.size() - file.size;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file.fd;
+    sqe->addr = (uint64_t)(uintptr_t)(file.data.data() + file.size);
+    sqe->len = (uint32_t)std::min<size_t>(remaining, 1 << 30);
+    sqe->off = file.size;
+    sqe->user_data = index;
+    stages[index] = Stage::Reading;
+    unsubmitted.push_back(index);
+  };
+
+  auto handleCompletion = [&](const io_uring_cqe & cqe)
+  {
+    size_t index = (size_t)cqe.user_data;
+    BatchFile & file = files[index];
+
+    if (cqe.res < 0)
+    {
+      finish(index, false);
+      return;
+    }
+
+    if (stages[index] == Stage::Opening)
+    {
+      file.fd = cqe.res;
+      struct stat st;
+      if (fstat(file.fd, &st))
+      {
+        finish(index, false);
+        return;
+      }
+      file.data.resize(st.st_size);
+      file.size = 0;
+      if (file.data.empty())
+      {
+        finish(index, true);
+        return;
+      }
+      queueRead(index);
+      return;
+    }
+
+    file.size += cqe.res;
+    if (cqe.res == 0 || file.size == file.data.size())
+    {
+      file.data.resize(file.size);
+      finish(index, true);
+      return;
+    }
+    queueRead(index);
+  };
+
+  bool failed = false;
+  while (next < files.size() || inFlight)
+  {
+    while (next < files.size() && inFlight < ring.size())
+    {
+      queue.waitForRoom(bufferLimit);
+      io_uring_sqe * sqe = ring.getSQE();
+      if (sqe == nullptr) { break; }
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t)(uintptr_t)files[next].path->c_str();
+      sqe->open_flags = O_RDONLY | O_CLOEXEC;
+      sqe->user_data = next;
+      stages[next] = Stage::Opening;
+      unsubmitted.push_back(next);
+      next++;
+      inFlight++;
+    }
+
+    int submitted = ring.submitAndWait();
+    if (submitted < 0)
+    {
+      failed = true;
+      break;
+    }
+    unsubmitted.erase(unsubmitted.begin(),
+      unsubmitted.begin() + std::min<size_t>(submitted, unsubmitted.size()));
+
+    ring.forEachCompletion(handleCompletion);
+  }
+
+  if (failed)
+  {
+    // The kernel never saw these entries, and now it never will.
+    ring.discardUnsubmitted();
+    for (size_t index : unsubmitted) { finish(index, false); }
+
+    // Ask the kernel to cancel the operations it does have.  An operation
+    // that is already running might finish anyway.
+    for (size_t i = 0; i < next; i++)
+    {
+      if (finished[i]) { continue; }
+      io_uring_sqe * sqe = ring.getSQE();
+      if (sqe == nullptr) { break; }
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = i;
+      sqe->user_data = cancelRequest;
+    }
+    ring.submit();
+    ring.discardUnsubmitted();
+
+    // Either way, the kernel can write into the buffers until each
+    // operation completes, so we wait for all of them before anything is
+    // freed.  If waiting in the kernel fails, the completions still show up
+    // in the ring, so we poll for them.
+    while (inFlight)
+    {
+      ring.forEachCompletion([&](const io_uring_cqe & cqe)
+      {
+        if (cqe.user_data == cancelRequest) { return; }
+        size_t index = (size_t)cqe.user_data;
+        if (stages[index] == Stage::Opening && cqe.res >= 0)
+        {
+          files[index].fd = cqe.res;
+        }
+        finish(index, false);
+      });
+      if (inFlight && !ring.wait())
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  for (size_t i = next; i < files.size(); i++)
+  {
+    queue.push(i, false);
+  }
+  return true;
+}
+
+#endif
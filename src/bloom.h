@@ -0,0 +1,87 @@
+// A blocked Bloom filter over symbol names.
+//
+// Each key is mapped to a single 512-bit block (one cache line) and sets a
+// few bits within that block, so a query touches at most one cache line.
+// With about 10 bits per key and 6 bits set per key, the false positive
+// rate is around 1%.
+
+static const size_t bloomWordsPerBlock = 8;
+static const size_t bloomBitsPerKey = 10;
+static const unsigned bloomBitsSetPerKey = 6;
+
+static uint64_t bloomHash(const char * str, size_t length)
+{
+  // FNV-1a followed by the MurmurHash3 finalizer to spread the bits.
+  uint64_t h = 0xcbf29ce484222325;
+  for (size_t i = 0; i < length; i++)
+  {
+    h ^= (uint8_t)str[i];
+    h *= 0x100000001b3;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53;
+  h ^= h >> 33;
+  return h;
+}
+
+// The block comes from the high 32 bits of the hash.  The bit positions
+// within the block come from a second mix of the hash, so they are not
+// correlated with the choice of block.  Each position takes 9 bits of it.
+static size_t bloomBlockIndex(uint64_t hash, size_t blockCount)
+{
+  return (size_t)(((hash >> 32) * (uint64_t)blockCount) >> 32);
+}
+
+static uint64_t bloomProbeBits(uint64_t hash)
+{
+  // The SplitMix64 finalizer.
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111eb;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+static void bloomInit(std::vector<uint64_t> & filter, size_t keyCount)
+{
+  size_t bitsPerBlock = bloomWordsPerBlock * 64;
+  size_t blockCount = (keyCount * bloomBitsPerKey + bitsPerBlock - 1) /
+    bitsPerBlock;
+  if (blockCount == 0) { blockCount = 1; }
+  filter.assign(blockCount * bloomWordsPerBlock, 0);
+}
+
+static void bloomInsert(std::vector<uint64_t> & filter,
+  const std::string & key)
+{
+  uint64_t hash = bloomHash(key.data(), key.size());
+  size_t blockCount = filter.size() / bloomWordsPerBlock;
+  uint64_t * block = &filter[bloomBlockIndex(hash, blockCount) *
+    bloomWordsPerBlock];
+  uint64_t probes = bloomProbeBits(hash);
+  for (unsigned i = 0; i < bloomBitsSetPerKey; i++)
+  {
+    unsigned bit = (probes >> (9 * i)) & 511;
+    block[bit >> 6] |= (uint64_t)1 << (bit & 63);
+  }
+}
+
+static bool bloomMayContain(const std::vector<uint64_t> & filter,
+  const std::string & key)
+{
+  if (filter.empty()) { return true; }
+  uint64_t hash = bloomHash(key.data(), key.size());
+  size_t blockCount = filter.size() / bloomWordsPerBlock;
+  const uint64_t * block = &filter[bloomBlockIndex(hash, blockCount) *
+    bloomWordsPerBlock];
+  uint64_t probes = bloomProbeBits(hash);
+  for (unsigned i = 0; i < bloomBitsSetPerKey; i++)
+  {
+    unsigned bit = (probes >> (9 * i)) & 511;
+    if (!(block[bit >> 6] & ((uint64_t)1 << (bit & 63)))) { return false; }
+  }
+  return true;
+}
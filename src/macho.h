@@ -0,0 +1,322 @@
+// Minimal reading of Mach-O files: just enough to walk the (fat) headers
+// and load commands without touching the rest of the file.
+
+// From Apple's mach-o/loader.h and mach-o/fat.h
+#define MH_MAGIC 0xfeedface
+#define MH_CIGAM 0xcefaedfe
+#define MH_MAGIC_64 0xfeedfacf
+#define MH_CIGAM_64 0xcffaedfe
+#define FAT_MAGIC 0xcafebabe
+#define FAT_MAGIC_64 0xcafebabf
+#define CPU_SUBTYPE_MASK 0xff000000
+#define MH_DYLIB 0x6
+#define MH_DYLIB_STUB 0x9
+#define MH_TWOLEVEL 0x80
+#define MH_APP_EXTENSION_SAFE 0x02000000
+#define LC_REQ_DYLD 0x80000000
+#define LC_ID_DYLIB 0xd
+#define LC_UUID 0x1b
+#define LC_DYLD_INFO 0x22
+#define LC_DYLD_INFO_ONLY (0x22 | LC_REQ_DYLD)
+#define LC_VERSION_MIN_MACOSX 0x24
+#define LC_VERSION_MIN_IPHONEOS 0x25
+#define LC_REEXPORT_DYLIB (0x1f | LC_REQ_DYLD)
+#define LC_VERSION_MIN_TVOS 0x2f
+#define LC_VERSION_MIN_WATCHOS 0x30
+#define LC_BUILD_VERSION 0x32
+#define LC_DYLD_EXPORTS_TRIE (0x33 | LC_REQ_DYLD)
+#define EXPORT_SYMBOL_FLAGS_KIND_MASK 0x03
+#define EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL 0x01
+#define EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION 0x04
+#define EXPORT_SYMBOL_FLAGS_REEXPORT 0x08
+#define EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER 0x10
+
+struct MachOSlice
+{
+  const uint8_t * data;
+  size_t size;
+
+  // From the fat header, or from the Mach-O header of a thin file.
+  cpu_type_t cpuType;
+  cpu_subtype_t cpuSubType;
+};
+
+// Big-endian read, used for fat headers.
+static uint32_t readBE32(const uint8_t * p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+    (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t readBE64(const uint8_t * p)
+{
+  return (uint64_t)readBE32(p) << 32 | readBE32(p + 4);
+}
+
+// A thin Mach-O file (or one slice of a fat file).
+class MachOFile
+{
+  const uint8_t * data = nullptr;
+  size_t size = 0;
+  bool swapped = false;
+  bool is64 = false;
+
+public:
+  uint32_t read32(size_t offset) const
+  {
+    uint32_t v;
+    memcpy(&v, data + offset, 4);
+    return swapped ? __builtin_bswap32(v) : v;
+  }
+
+  uint64_t read64(size_t offset) const
+  {
+    uint64_t v;
+    memcpy(&v, data + offset, 8);
+    return swapped ? __builtin_bswap64(v) : v;
+  }
+
+  bool init(MachOSlice slice)
+  {
+    data = slice.data;
+    size = slice.size;
+    if (size < 28) { return false; }
+    uint32_t magic;
+    memcpy(&magic, data, 4);
+    swapped = magic == MH_CIGAM || magic == MH_CIGAM_64;
+    is64 = magic == MH_MAGIC_64 || magic == MH_CIGAM_64;
+    if (!swapped && !is64 && magic != MH_MAGIC) { return false; }
+    return size >= headerSize() + sizeOfCommands();
+  }
+
+  const uint8_t * getData() const noexcept { return data; }
+  size_t getSize() const noexcept { return size; }
+
+  cpu_type_t cpuType() const { return (cpu_type_t)read32(4); }
+  cpu_subtype_t cpuSubType() const
+  {
+    return (cpu_subtype_t)(read32(8) & ~CPU_SUBTYPE_MASK);
+  }
+  uint32_t fileType() const { return read32(12); }
+  uint32_t commandCount() const { return read32(16); }
+  uint32_t sizeOfCommands() const { return read32(20); }
+  uint32_t flags() const { return read32(24); }
+  size_t headerSize() const { return is64 ? 32 : 28; }
+
+  // Calls the function with the type, offset and size of each load
+  // command.  Stops early if the function returns false.  Returns false
+  // if the load commands are malformed.
+  template <typename F>
+  bool forEachLoadCommand(F f) const
+  {
+    size_t offset = headerSize();
+    size_t end = offset + sizeOfCommands();
+    uint32_t count = commandCount();
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (offset + 8 > end) { return false; }
+      uint32_t cmd = read32(offset);
+      uint32_t cmdSize = read32(offset + 4);
+      if (cmdSize < 8 || cmdSize > end - offset) { return false; }
+      if (!f(cmd, offset, cmdSize)) { return true; }
+      offset += cmdSize;
+    }
+    return true;
+  }
+
+  // Reads the NUL-terminated string at the given offset within a load
+  // command, without going past the end of the command.
+  std::string readCommandString(size_t cmdOffset, uint32_t cmdSize,
+    uint32_t stringOffset) const
+  {
+    if (stringOffset >= cmdSize) { return ""; }
+    const char * start = (const char *)data + cmdOffset + stringOffset;
+    return std::string(start, strnlen(start, cmdSize - stringOffset));
+  }
+
+  bool getInstallName(std::string & name) const
+  {
+    bool found = false;
+    forEachLoadCommand([&](uint32_t cmd, size_t offset, uint32_t cmdSize) {
+      if (cmd != LC_ID_DYLIB || cmdSize < 24) { return true; }
+      name = readCommandString(offset, cmdSize, read32(offset + 8));
+      found = true;
+      return false;
+    });
+    return found;
+  }
+
+  bool getUUID(uint8_t uuid[16]) const
+  {
+    bool found = false;
+    forEachLoadCommand([&](uint32_t cmd, size_t offset, uint32_t cmdSize) {
+      if (cmd != LC_UUID || cmdSize < 24) { return true; }
+      memcpy(uuid, data + offset + 8, 16);
+      found = true;
+      return false;
+    });
+    return found;
+  }
+};
+
+static bool detectMachO(const uint8_t * data, size_t size)
+{
+  if (size < 4) { return false; }
+  uint32_t magic;
+  memcpy(&magic, data, 4);
+  return magic == MH_MAGIC || magic == MH_CIGAM ||
+    magic == MH_MAGIC_64 || magic == MH_CIGAM_64 ||
+    readBE32(data) == FAT_MAGIC || readBE32(data) == FAT_MAGIC_64;
+}
+
+// Reads the CPU type of a thin Mach-O file without checking anything else
+// in its header.  Leaves it as 0 if the file is not a Mach-O file.
+static void readSliceCpuType(MachOSlice & slice)
+{
+  slice.cpuType = 0;
+  slice.cpuSubType = 0;
+  if (slice.size < 12) { return; }
+  uint32_t magic, cpuType, cpuSubType;
+  memcpy(&magic, slice.data, 4);
+  memcpy(&cpuType, slice.data + 4, 4);
+  memcpy(&cpuSubType, slice.data + 8, 4);
+  if (magic == MH_CIGAM || magic == MH_CIGAM_64)
+  {
+    cpuType = __builtin_bswap32(cpuType);
+    cpuSubType = __builtin_bswap32(cpuSubType);
+  }
+  else if (magic != MH_MAGIC && magic != MH_MAGIC_64)
+  {
+    return;
+  }
+  slice.cpuType = (cpu_type_t)cpuType;
+  slice.cpuSubType = (cpu_subtype_t)(cpuSubType & ~CPU_SUBTYPE_MASK);
+}
+
+// Returns the thin Mach-O slices in a file, which is just the file itself
+// if it is not a fat file.  Slices that do not fit in the file are skipped.
+// Only the fat header is read, so the slices might not be valid.
+static std::vector<MachOSlice> getMachOSlices(const uint8_t * data,
+  size_t size)
+{
+  std::vector<MachOSlice> slices;
+  if (size < 8) { return slices; }
+
+  uint32_t magic = readBE32(data);
+  if (magic != FAT_MAGIC && magic != FAT_MAGIC_64)
+  {
+    MachOSlice slice = { data, size, 0, 0 };
+    readSliceCpuType(slice);
+    slices.push_back(slice);
+    return slices;
+  }
+
+  bool fat64 = magic == FAT_MAGIC_64;
+  size_t entrySize = fat64 ? 32 : 20;
+  uint32_t count = readBE32(data + 4);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    size_t entry = 8 + i * entrySize;
+    if (entry + entrySize > size) { break; }
+    uint64_t offset = fat64 ? readBE64(data + entry + 8) :
+      readBE32(data + entry + 8);
+    uint64_t sliceSize = fat64 ? readBE64(data + entry + 16) :
+      readBE32(data + entry + 12);
+    if (offset > size || sliceSize > size - offset) { continue; }
+    cpu_type_t cpuType = (cpu_type_t)readBE32(data + entry);
+    cpu_subtype_t cpuSubType = (cpu_subtype_t)(readBE32(data + entry + 4) &
+      ~CPU_SUBTYPE_MASK);
+    slices.push_back({ data + offset, (size_t)sliceSize,
+      cpuType, cpuSubType });
+  }
+  return slices;
+}
+
+static bool readULEB128(const uint8_t *& p, const uint8_t * end,
+  uint64_t & value)
+{
+  value = 0;
+  unsigned shift = 0;
+  while (p < end)
+  {
+    uint8_t byte = *p++;
+    if (shift < 64) { value |= (uint64_t)(byte & 0x7f) << shift; }
+    shift += 7;
+    if (!(byte & 0x80)) { return true; }
+  }
+  return false;
+}
+
+// Walks the export trie in place, calling f(name, flags) for each exported
+// symbol in trie order.  Returns false if the trie is malformed.  Each node
+// is visited at most once, so this terminates even if the trie has cycles.
+template <typename F>
+static bool walkExportTrie(const uint8_t * trie, size_t size, F f)
+{
+  if (size == 0) { return true; }
+
+  // The state of a node whose children we are still visiting.
+  struct Frame
+  {
+    const uint8_t * nextEdge;
+    unsigned remainingChildren;
+    size_t prefixLength;
+  };
+
+  const uint8_t * end = trie + size;
+  std::vector<bool> visited(size);
+  std::vector<Frame> stack;
+  std::string name;
+
+  // Reports the node's symbol if it has one and pushes a frame for its
+  // children.
+  auto enterNode = [&](uint64_t offset) -> bool
+  {
+    if (offset >= size || visited[offset]) { return false; }
+    visited[offset] = true;
+
+    const uint8_t * p = trie + offset;
+    uint64_t terminalSize;
+    if (!readULEB128(p, end, terminalSize)) { return false; }
+    if (terminalSize >= (uint64_t)(end - p)) { return false; }
+    const uint8_t * children = p + terminalSize;
+    if (terminalSize)
+    {
+      uint64_t flags;
+      if (!readULEB128(p, children, flags)) { return false; }
+      f(name, flags);
+    }
+
+    stack.push_back({ children + 1, *children, name.size() });
+    return true;
+  };
+
+  if (!enterNode(0)) { return false; }
+
+  while (stack.size())
+  {
+    Frame & frame = stack.back();
+    if (frame.remainingChildren == 0)
+    {
+      stack.pop_back();
+      continue;
+    }
+    frame.remainingChildren--;
+
+    const uint8_t * p = frame.nextEdge;
+    const uint8_t * edge = p;
+    while (p < end && *p) { p++; }
+    if (p >= end) { return false; }
+    size_t edgeLength = p - edge;
+    p++;  // Skip the NUL.
+
+    uint64_t childOffset;
+    if (!readULEB128(p, end, childOffset)) { return false; }
+    frame.nextEdge = p;
+
+    name.resize(frame.prefixLength);
+    name.append((const char *)edge, edgeLength);
+    if (!enterNode(childOffset)) { return false; }
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+// Read-only memory mapping of a whole file.  Only the pages that are
+// actually accessed get read from disk.
+
+class MappedFile
+{
+  const uint8_t * mapping = nullptr;
+  size_t length = 0;
+  struct stat info;
+
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+
+  ~MappedFile()
+  {
+    if (mapping != nullptr) { munmap((void *)mapping, length); }
+  }
+
+  bool open(const std::string & path)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) { return false; }
+
+    if (fstat(fd, &info) || info.st_size <= 0)
+    {
+      close(fd);
+      return false;
+    }
+
+    void * p = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { return false; }
+
+    mapping = (const uint8_t *)p;
+    length = info.st_size;
+    return true;
+  }
+
+  // The status of the file that was opened, which might be different from
+  // what is at the path now.
+  const struct stat & status() const noexcept { return info; }
+
+  const uint8_t * data() const noexcept { return mapping; }
+  size_t size() const noexcept { return length; }
+};
@@ -0,0 +1,39 @@
+// Static tracepoints (USDT) for bpftrace, perf and SystemTap.  Each probe
+// compiles to a single nop plus a note in the .note.stapsdt section, so it
+// costs nothing until a tracer attaches to it.  If sys/sdt.h is not
+// available, the probes compile to nothing.
+//
+// The provider is "tinytapi".  For example, to see how long create takes
+// for each file:
+//
+//   bpftrace -e 'usdt:./libtapi.so:tinytapi:create__start
+//     { @start[tid] = nsecs; }
+//     usdt:./libtapi.so:tinytapi:create__done /@start[tid]/
+//     { printf("%s %d us\n", str(arg0), (nsecs - @start[tid]) / 1000); }'
+//
+// The probes and their arguments are:
+//
+//   create__start(path, size, cpuType, cpuSubType)
+//   create__done(path, exportCount, undefinedCount, error)
+//   parse__start(path, size, isMachO)
+//   parse__done(path, symbolCount, error)
+//   arch__select(path, wantedArchName, selectedArchName)
+//   materialize__start(path, archName, wantedSymbolCount)
+//   materialize__done(path, exportCount, undefinedCount)
+//   hide__done(path, hideCommandCount, hiddenCount)
+//
+// Strings are NUL-terminated and error is empty if there was no error.
+// selectedArchName is "none" if the file lacks the wanted architecture.
+// wantedSymbolCount is 0 unless the file is made by createForSymbols.
+// Symbol counts are taken before hidden symbols are removed, except in
+// create__done.
+
+#ifdef _SYS_SDT_H
+#define TAPI_PROBE3(name, a, b, c) \
+  DTRACE_PROBE3(tinytapi, name, a, b, c)
+#define TAPI_PROBE4(name, a, b, c, d) \
+  DTRACE_PROBE4(tinytapi, name, a, b, c, d)
+#else
+#define TAPI_PROBE3(name, a, b, c) ((void)0)
+#define TAPI_PROBE4(name, a, b, c, d) ((void)0)
+#endif
@@ -0,0 +1,359 @@
+// Quick inspection of the top-level keys of a TBD file, for questions
+// that don't need the symbols.  Instead of running the YAML parser, we
+// look at the lines that start in the first column, which are the
+// top-level keys of a TBD file's mapping, and skip over the values of the
+// keys we don't need.
+//
+// TBD writers put the symbol lists ("exports" and "undefineds") after all
+// the other keys, so we stop at the first of them.  That way we only read
+// the header of the file, usually less than a page, and a key that is not
+// in the header is taken to be missing.
+//
+// This only understands the simple YAML that TBD files are written in.  If
+// it sees anything else, it gives up and the caller should parse the file
+// properly.
+
+enum class HeaderAnswer { No, Yes, Unknown };
+
+// The keys of a TBD header that we can read.
+struct StubHeader
+{
+  bool hasFlags = false;
+  std::vector<std::string> flags;
+  bool hasInstallName = false;
+  std::string installName;
+  bool hasUUIDs = false;
+  std::vector<std::string> uuids;
+};
+
+struct HeaderLine
+{
+  const char * begin;
+  const char * end;
+};
+
+// Returns the lines of the text one at a time, without the line endings.
+class HeaderLineReader
+{
+  const char * pos;
+  const char * limit;
+
+public:
+  HeaderLineReader(const uint8_t * data, size_t size)
+    : pos((const char *)data), limit((const char *)data + size) { }
+
+  bool next(HeaderLine & line)
+  {
+    if (pos >= limit) { return false; }
+    const char * eol = (const char *)memchr(pos, '\n', limit - pos);
+    if (eol == nullptr) { eol = limit; }
+    line.begin = pos;
+    line.end = eol;
+    if (line.end > line.begin && line.end[-1] == '\r') { line.end--; }
+    pos = eol + 1;
+    return true;
+  }
+
+  // Returns true if the next line starts with whitespace, meaning that it
+  // continues the value of the current top-level key.
+  bool nextIsIndented() const
+  {
+    return pos < limit && (*pos == ' ' || *pos == '\t');
+  }
+
+  // Returns true if the next line is an entry of a block sequence that is
+  // not indented, which YAML allows for the value of a top-level key.
+  bool nextIsSequenceEntry() const
+  {
+    return pos < limit && *pos == '-' && (pos + 1 == limit ||
+      pos[1] == ' ' || pos[1] == '\t' || pos[1] == '\r' || pos[1] == '\n');
+  }
+
+  bool nextIsBlank() const
+  {
+    return pos < limit && (*pos == '\n' || *pos == '\r');
+  }
+
+  bool nextContinuesValue() const
+  {
+    return nextIsIndented() || nextIsSequenceEntry() || nextIsBlank();
+  }
+};
+
+static bool isHeaderSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static std::string trimHeaderText(const char * begin, const char * end)
+{
+  while (begin < end && isHeaderSpace(*begin)) { begin++; }
+  while (end > begin && isHeaderSpace(end[-1])) { end--; }
+  return std::string(begin, end);
+}
+
+static std::string trimHeaderText(const std::string & text)
+{
+  return trimHeaderText(text.data(), text.data() + text.size());
+}
+
+static bool lineStartsWith(const HeaderLine & line, const char * prefix)
+{
+  size_t length = strlen(prefix);
+  return (size_t)(line.end - line.begin) >= length &&
+    memcmp(line.begin, prefix, length) == 0;
+}
+
+// Removes the comment from some text on one line, and adds the number of
+// flow collections ("[" and "{") it opens, minus the number it closes, to
+// depth.  Returns false if it has a quoted string that goes on to the next
+// line or has escapes, since we don't handle those.
+static bool stripHeaderLine(std::string & text, int & depth)
+{
+  char quote = 0;
+  char previous = ' ';
+  for (size_t i = 0; i < text.size(); i++)
+  {
+    char c = text[i];
+    if (quote)
+    {
+      if (c == '\\') { return false; }
+      if (c == quote) { quote = 0; }
+    }
+    else if (c == '#')
+    {
+      // Whether a "#" that doesn't follow a space starts a comment depends
+      // on the context, so we don't try.
+      if (!isHeaderSpace(previous)) { return false; }
+      text.resize(i);
+      break;
+    }
+    else if ((c == '\'' || c == '"') &&
+      (isHeaderSpace(previous) || strchr("[{,:-", previous)))
+    {
+      quote = c;
+    }
+    else if (c == '[' || c == '{')
+    {
+      // Inside a plain scalar this wouldn't start a collection.
+      if (!isHeaderSpace(previous) && !strchr("[{,:", previous))
+      {
+        return false;
+      }
+      depth++;
+    }
+    else if (c == ']' || c == '}')
+    {
+      if (--depth < 0) { return false; }
+    }
+    previous = c;
+  }
+  return quote == 0;
+}
+
+// Reads a scalar that is the value of a key or an entry of a list,
+// removing quotes.  Returns false if it uses YAML features we don't handle
+// here.
+static bool readHeaderScalar(std::string text, std::string & value)
+{
+  value.clear();
+  if (text.empty()) { return true; }
+  char first = text[0];
+  if (strchr("&*!|>[]{}?%@`,", first)) { return false; }
+  if (first == '\'' || first == '"')
+  {
+    if (text.size() < 2 || text.back() != first) { return false; }
+    text = text.substr(1, text.size() - 2);
+    if (text.find(first) != std::string::npos) { return false; }
+  }
+  else if (text.find(": ") != std::string::npos || text.back() == ':')
+  {
+    // This would be a mapping.
+    return false;
+  }
+  value = text;
+  return true;
+}
+
+// Skips the value of a key we are not interested in, given the depth of
+// the flow collections still open on the line of the key.
+static bool skipHeaderValue(const std::string & value, int depth,
+  HeaderLineReader & reader)
+{
+  HeaderLine line{};
+  if (depth == 0 && value.size() && (value[0] == '|' || value[0] == '>'))
+  {
+    // A block scalar, which can contain anything.
+    while (reader.nextIsIndented() || reader.nextIsBlank())
+    {
+      if (!reader.next(line)) { break; }
+    }
+    return true;
+  }
+
+  while (depth > 0 || reader.nextContinuesValue())
+  {
+    if (!reader.next(line)) { return false; }
+    std::string text(line.begin, line.end);
+    if (!stripHeaderLine(text, depth)) { return false; }
+  }
+  return true;
+}
+
+// Reads a list of scalars, given the text after the colon.
+static bool readHeaderList(std::string value, int depth,
+  HeaderLineReader & reader, std::vector<std::string> & list)
+{
+  HeaderLine line{};
+  if (value.empty() && reader.nextIsIndented())
+  {
+    // The value starts on the next line, either as a flow sequence or as
+    // a block sequence that is indented.
+    HeaderLineReader peek = reader;
+    if (!peek.next(line)) { return false; }
+    std::string text = trimHeaderText(line.begin, line.end);
+    if (text.size() && text[0] == '[')
+    {
+      reader = peek;
+      value = text;
+      if (!stripHeaderLine(value, depth)) { return false; }
+      value = trimHeaderText(value);
+    }
+  }
+
+  if (value.empty())
+  {
+    // Block sequence: "- entry" lines, indented or not.
+    while (reader.nextContinuesValue())
+    {
+      if (!reader.next(line)) { return false; }
+      std::string item(line.begin, line.end);
+      if (!stripHeaderLine(item, depth) || depth) { return false; }
+      item = trimHeaderText(item);
+      if (item.empty()) { continue; }
+      if (item.size() < 2 || item[0] != '-' || !isHeaderSpace(item[1]))
+      {
+        return false;
+      }
+      std::string entry;
+      if (!readHeaderScalar(trimHeaderText(item.substr(2)), entry))
+      {
+        return false;
+      }
+      list.push_back(entry);
+    }
+    return true;
+  }
+
+  if (value[0] != '[') { return false; }
+
+  // Flow sequence, which might continue on the following lines.
+  while (depth > 0)
+  {
+    if (!reader.next(line)) { return false; }
+    std::string text(line.begin, line.end);
+    if (!stripHeaderLine(text, depth)) { return false; }
+    value += ' ';
+    value += trimHeaderText(text);
+  }
+  value = trimHeaderText(value);
+  if (value.back() != ']' || value.find(']') != value.size() - 1)
+  {
+    return false;
+  }
+
+  const char * p = &value[1];
+  const char * end = &value[0] + value.size() - 1;
+  while (p < end)
+  {
+    const char * comma = std::find(p, end, ',');
+    std::string entry;
+    if (!readHeaderScalar(trimHeaderText(p, comma), entry)) { return false; }
+    if (entry.size()) { list.push_back(entry); }
+    p = comma + 1;
+  }
+  return true;
+}
+
+// Reads the header of the first document in a TBD file.  Returns false if
+// the file uses YAML that we don't handle here.
+static bool scanStubHeader(const uint8_t * data, size_t size,
+  StubHeader & header)
+{
+  HeaderLineReader reader(data, size);
+  HeaderLine line{};
+  bool inDocument = false;
+  while (reader.next(line))
+  {
+    if (line.begin == line.end) { continue; }
+    char first = *line.begin;
+
+    if (lineStartsWith(line, "---"))
+    {
+      // The end of the first document.
+      if (inDocument) { return true; }
+      inDocument = true;
+      continue;
+    }
+    if (lineStartsWith(line, "...")) { return true; }
+    if (first == '#' || first == '%') { continue; }
+
+    // Indented lines and sequence entries are always skipped along with
+    // the value of a key, so here they mean that the mapping itself is
+    // indented or the document is not a mapping.
+    if (isHeaderSpace(first) || first == '-') { return false; }
+    inDocument = true;
+
+    const char * colon = (const char *)memchr(line.begin, ':',
+      line.end - line.begin);
+    if (colon == nullptr) { return false; }
+    if (colon + 1 < line.end && !isHeaderSpace(colon[1])) { return false; }
+    std::string key(line.begin, colon);
+    if (key.find_first_of("'\"?{[&*!# \t") != std::string::npos)
+    {
+      return false;
+    }
+    if (key == "exports" || key == "undefineds") { return true; }
+
+    std::string value(colon + 1, line.end);
+    int depth = 0;
+    if (!stripHeaderLine(value, depth)) { return false; }
+    value = trimHeaderText(value);
+
+    if (key == "flags" || key == "uuids")
+    {
+      bool & seen = key == "flags" ? header.hasFlags : header.hasUUIDs;
+      if (seen) { return false; }
+      seen = true;
+      std::vector<std::string> & list = key == "flags" ? header.flags :
+        header.uuids;
+      if (!readHeaderList(value, depth, reader, list)) { return false; }
+    }
+    else if (key == "install-name")
+    {
+      if (header.hasInstallName || depth) { return false; }
+      header.hasInstallName = true;
+      if (!readHeaderScalar(value, header.installName)) { return false; }
+
+      // A plain scalar can go on to the next lines.
+      if (reader.nextIsIndented()) { return false; }
+    }
+    else if (!skipHeaderValue(value, depth, reader))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Finds out whether the TBD file has the "installapi" flag, which means
+// that it was generated by the installapi tool from headers rather than
+// from a built dylib.
+static HeaderAnswer scanForInstallAPIFlag(const uint8_t * data, size_t size)
+{
+  StubHeader header;
+  if (!scanStubHeader(data, size, header)) { return HeaderAnswer::Unknown; }
+  bool found = std::find(header.flags.begin(), header.flags.end(),
+    "installapi") != header.flags.end();
+  return found ? HeaderAnswer::Yes : HeaderAnswer::No;
+}
@@ -6,41 +6,142 @@
 
 // Standard external libraries
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
 #include <set>
-#include <iostream>  // TODO: remove
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <system_error>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#endif
+
+using namespace tapi;
 
 // Components of this compilation unit
+#include "allocator.h"
 #include "arch.h"
+#include "batch.h"
+#include "bloom.h"
+#include "macho.h"
+#include "mapped_file.h"
+#include "probes.h"
+#include "stub_header.h"
+#include "trace.h"
+
+// The parsed contents of a TBD file or dylib are stored in a few flat
+// tables instead of a tree of small allocations.  Every name is stored in
+// one buffer, StubData::names, and referred to by its offset and size.
+struct StubName
+{
+  uint32_t offset;
+  uint32_t size;
+};
 
-using namespace tapi;
+// A symbol as written in a TBD file: for Objective-C symbols, the name
+// does not include the prefix implied by the kind.
+struct StubSymbol
+{
+  StubName name;
+  SymbolKind kind;
+  bool weak;
+  bool threadLocal;
+};
+
+enum class SectionKind : uint8_t
+{
+  Export,
+  Undefined,
+  Reexport,
+};
 
-struct ExportItem
+// A run of consecutive entries of StubData::symbols that apply to the same
+// architectures.  For a Reexport section, the entries are install names and
+// only their names are used.
+struct StubSection
 {
-  std::vector<Architecture> archs;
-  std::vector<std::string> symbols, weak_symbols,
-    objc_classes, objc_ivars, reexports;
+  uint32_t archMask;
+  SectionKind kind;
+  size_t first;
+  size_t count;
+};
 
-  bool hasArch(Architecture arch) const noexcept
-  {
-    for (Architecture a : archs)
-    {
-      if (a == arch) { return true; }
-    }
-    return false;
-  }
+static uint32_t archBit(Architecture arch)
+{
+  return 1u << (unsigned)arch;
+}
+
+// A "$ld$hide$os<version>$<name>" command from the exports of a TBD file.
+// The symbol is hidden when the minimum OS version is at most osVersion.
+struct HideCommand
+{
+  PackedVersion32 osVersion;
+  uint32_t archMask;
+  StubName hiddenName;
+};
+
+struct ArchUUID
+{
+  Architecture arch;
+  uint8_t uuid[16];
 };
 
 struct tapi::StubData
 {
   std::string filename;
-  std::vector<Architecture> archs;
+  StubVector<Architecture> archs;
   Platform platform = Platform::Unknown;
-  std::string installName;
+  StubString installName;
   PackedVersion32 currentVersion, compatVersion;
   unsigned swiftVersion = 0;
   bool applicationExtensionSafe = true;
   bool twoLevelNamespace = true;
-  std::vector<ExportItem> exports, undefineds;
+  bool installAPI = false;
+  StubVector<ArchUUID> uuids;
+
+  // The exports, undefined symbols, and re-exports, in the order they were
+  // parsed.  The parser only ever appends to these tables.
+  StubVector<StubSection> sections;
+  StubVector<StubSymbol> symbols;
+  StubString names;
+
+  // True if the names did not fit in 4 GiB, in which case some of them
+  // were left out.
+  bool tooManyNames = false;
+
+  // Sorted by descending OS version, so the commands that apply to a given
+  // minimum OS version are a prefix of this list.
+  StubVector<HideCommand> hideCommands;
+
+  const char * nameData(StubName name) const noexcept
+  {
+    return names.data() + name.offset;
+  }
+
+  std::string nameString(StubName name) const
+  {
+    return std::string(nameData(name), name.size);
+  }
 };
 
 unsigned APIVersion::getMajor() noexcept
@@ -89,6 +190,13 @@ static std::string convertYAMLString(const yaml_node_t * node)
     node->data.scalar.length };
 }
 
+static StubString convertYAMLStubString(const yaml_node_t * node)
+{
+  if (node->type != YAML_SCALAR_NODE) { return StubString(); }
+  return StubString((const char *)node->data.scalar.value,
+    node->data.scalar.length);
+}
+
 static unsigned convertYAMLUnsignedInt(const yaml_node_t * node)
 {
   std::string str = convertYAMLString(node);
@@ -109,12 +217,11 @@ static unsigned convertYAMLUnsignedInt(const yaml_node_t * node)
   return r;
 }
 
-static PackedVersion32 parseVersion(const char * str)
+static PackedVersion32 parseVersion(const char * p, const char * end)
 {
-  const char * p = str;
   unsigned numbers[3] = { 0, 0, 0 };
   unsigned index = 0;
-  while (*p && index <= 2)
+  while (p < end && index <= 2)
   {
     if (*p == '.')
     {
@@ -136,30 +243,96 @@ static PackedVersion32 parseVersion(const char * str)
 
 static PackedVersion32 parseVersion(const std::string & str)
 {
-  return parseVersion(str.c_str());
+  return parseVersion(str.data(), str.data() + str.size());
+}
+
+static bool isHideCommand(const char * name, size_t size)
+{
+  return size >= 9 && memcmp(name, "$ld$hide$", 9) == 0;
 }
 
-static bool parseHideCommand(const std::string & name,
-  PackedVersion32 & osVersion, std::string & hiddenName)
+// On success, the hidden name is the part of the name that starts at
+// hiddenStart.
+static bool parseHideCommand(const char * name, size_t size,
+  PackedVersion32 & osVersion, size_t & hiddenStart)
 {
-  const char * p = name.c_str();
-  if (strncmp(p, "$ld$hide$os", 11)) { return false; }
-  p += 11;
-  osVersion = parseVersion(p);
+  const char * end = name + size;
+  if (size < 11 || memcmp(name, "$ld$hide$os", 11)) { return false; }
+  const char * p = name + 11;
+  osVersion = parseVersion(p, end);
 
   // Find the '$' after the version number.
   while (true)
   {
+    if (p == end || !*p) { return false; }
     if (*p == '$') { break; }
-    if (!*p) { return false; }
     p++;
   }
   p++;  // Advance past the '$'
 
-  hiddenName = p;
+  hiddenStart = p - name;
   return true;
 }
 
+static StubName addStubName(StubData & d, const char * data, size_t size)
+{
+  if (size > UINT32_MAX || d.names.size() > UINT32_MAX - size)
+  {
+    d.tooManyNames = true;
+    return { 0, 0 };
+  }
+  StubName name = { (uint32_t)d.names.size(), (uint32_t)size };
+  d.names.append(data, size);
+  return name;
+}
+
+// Starts a new section, which addStubEntry adds entries to.
+static void beginSection(StubData & d, SectionKind kind, uint32_t archMask)
+{
+  d.sections.push_back({ archMask, kind, d.symbols.size(), 0 });
+}
+
+// Removes the last section if nothing was added to it.
+static void endSection(StubData & d)
+{
+  if (d.sections.back().count == 0) { d.sections.pop_back(); }
+}
+
+// Adds an entry to the last section.  In an export section, a "$ld$hide$"
+// symbol is added to d.hideCommands instead, so that we only have to look
+// for them once per file.
+static void addStubEntry(StubData & d, const char * name, size_t size,
+  SymbolKind kind, bool weak, bool threadLocal)
+{
+  StubSection & section = d.sections.back();
+  if (section.kind == SectionKind::Export &&
+    kind == SymbolKind::GlobalSymbol && isHideCommand(name, size))
+  {
+    HideCommand command;
+    size_t hiddenStart;
+    command.archMask = section.archMask;
+    if (parseHideCommand(name, size, command.osVersion, hiddenStart))
+    {
+      command.hiddenName = addStubName(d, name + hiddenStart,
+        size - hiddenStart);
+      d.hideCommands.push_back(command);
+    }
+    return;
+  }
+
+  d.symbols.push_back({ addStubName(d, name, size), kind, weak,
+    threadLocal });
+  section.count++;
+}
+
+static void sortHideCommands(StubData & d)
+{
+  std::stable_sort(d.hideCommands.begin(), d.hideCommands.end(),
+    [](const HideCommand & a, const HideCommand & b) {
+      return a.osVersion > b.osVersion;
+    });
+}
+
 static PackedVersion32 convertYAMLVersion(const yaml_node_t * node)
 {
   return parseVersion(convertYAMLString(node));
@@ -176,37 +349,85 @@ static Platform convertYAMLPlatform(const yaml_node_t * node)
   return Platform::Unknown;
 }
 
-static std::vector<std::string> convertYAMLStringList(
+static StubVector<StubString> convertYAMLStringList(
   yaml_document_t * doc, yaml_node_t * node)
 {
-  if (node->type != YAML_SEQUENCE_NODE) { return {}; }
-  std::vector<std::string> list;
+  StubVector<StubString> list;
+  if (node->type != YAML_SEQUENCE_NODE) { return list; }
   yaml_node_item_t * start = node->data.sequence.items.start;
   yaml_node_item_t * top = node->data.sequence.items.top;
   for (yaml_node_item_t * i = start; i < top; i++)
   {
     yaml_node_t * child = yaml_document_get_node(doc, *i);
-    list.push_back(convertYAMLString(child));
+    list.push_back(convertYAMLStubString(child));
   }
   return list;
 }
 
-static std::vector<Architecture> convertYAMLArchList(
+static StubVector<Architecture> convertYAMLArchList(
   yaml_document_t * doc, yaml_node_t * node)
 {
-  std::vector<Architecture> list;
-  for (const std::string & name : convertYAMLStringList(doc, node))
+  StubVector<Architecture> list;
+  for (const StubString & name : convertYAMLStringList(doc, node))
   {
-    Architecture arch = getArchByName(name);
+    Architecture arch = getArchByName(toStdString(name));
     if (arch != Architecture::None) { list.push_back(arch); }
   }
   return list;
 }
 
+static int hexDigitValue(char c)
+{
+  if (c >= '0' && c <= '9') { return c - '0'; }
+  if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+  if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+  return -1;
+}
+
+// Parses an entry like "x86_64: 4C4C4453-5555-3144-A1B5-A08A0C9A8FD8".
+static bool parseUUIDEntry(const StubString & str, ArchUUID & out)
+{
+  size_t colon = str.find(':');
+  if (colon == StubString::npos) { return false; }
+  out.arch = getArchByName(std::string(str.data(), colon));
+  if (out.arch == Architecture::None) { return false; }
+
+  size_t digitCount = 0;
+  for (size_t i = colon + 1; i < str.size(); i++)
+  {
+    char c = str[i];
+    if (c == ' ' || c == '-') { continue; }
+    int value = hexDigitValue(c);
+    if (value < 0 || digitCount >= 32) { return false; }
+    if (digitCount % 2 == 0)
+    {
+      out.uuid[digitCount / 2] = value << 4;
+    }
+    else
+    {
+      out.uuid[digitCount / 2] |= value;
+    }
+    digitCount++;
+  }
+  return digitCount == 32;
+}
+
+static StubVector<ArchUUID> convertYAMLUUIDList(
+  yaml_document_t * doc, yaml_node_t * node)
+{
+  StubVector<ArchUUID> list;
+  for (const StubString & entry : convertYAMLStringList(doc, node))
+  {
+    ArchUUID uuid;
+    if (parseUUIDEntry(entry, uuid)) { list.push_back(uuid); }
+  }
+  return list;
+}
+
 static void parseYAMLFlagList(yaml_document_t * doc,
   yaml_node_t * node, StubData & out)
 {
-  for (const std::string & name : convertYAMLStringList(doc, node))
+  for (const StubString & name : convertYAMLStringList(doc, node))
   {
     if (name == "not_app_extension_safe")
     {
@@ -216,14 +437,58 @@ static void parseYAMLFlagList(yaml_document_t * doc,
     {
       out.twoLevelNamespace = false;
     }
+    else if (name == "installapi")
+    {
+      out.installAPI = true;
+    }
   }
 }
 
-static ExportItem convertYAMLExportItem(
-  yaml_document_t * doc, yaml_node_t * node)
+static uint32_t convertYAMLArchMask(yaml_document_t * doc, yaml_node_t * node)
+{
+  uint32_t mask = 0;
+  for (Architecture arch : convertYAMLArchList(doc, node))
+  {
+    mask |= archBit(arch);
+  }
+  return mask;
+}
+
+// Adds the strings in a YAML sequence to the last section.
+static void appendYAMLSymbols(yaml_document_t * doc, yaml_node_t * node,
+  SymbolKind kind, bool weak, bool threadLocal, StubData & d)
+{
+  if (node == nullptr || node->type != YAML_SEQUENCE_NODE) { return; }
+  yaml_node_item_t * start = node->data.sequence.items.start;
+  yaml_node_item_t * top = node->data.sequence.items.top;
+  for (yaml_node_item_t * i = start; i < top; i++)
+  {
+    yaml_node_t * child = yaml_document_get_node(doc, *i);
+    const char * name = "";
+    size_t size = 0;
+    if (child->type == YAML_SCALAR_NODE)
+    {
+      name = (const char *)child->data.scalar.value;
+      size = child->data.scalar.length;
+    }
+    addStubEntry(d, name, size, kind, weak, threadLocal);
+  }
+}
+
+static void convertYAMLExportItem(yaml_document_t * doc, yaml_node_t * node,
+  SectionKind kind, StubData & d)
 {
-  ExportItem item;
-  if (node->type != YAML_MAPPING_NODE) { return item; }
+  if (node->type != YAML_MAPPING_NODE) { return; }
+
+  uint32_t archMask = 0;
+  yaml_node_t * symbols = nullptr;
+  yaml_node_t * weak_symbols = nullptr;
+  yaml_node_t * tlv_symbols = nullptr;
+  yaml_node_t * objc_classes = nullptr;
+  yaml_node_t * objc_eh_types = nullptr;
+  yaml_node_t * objc_ivars = nullptr;
+  yaml_node_t * reexports = nullptr;
+
   yaml_node_pair_t * start = node->data.mapping.pairs.start;
   yaml_node_pair_t * top = node->data.mapping.pairs.top;
   for (yaml_node_pair_t * pair = start; pair < top; pair++)
@@ -237,45 +502,297 @@ static ExportItem convertYAMLExportItem(
 
     if (key == "archs")
     {
-      item.archs = convertYAMLArchList(doc, value_node);
+      archMask = convertYAMLArchMask(doc, value_node);
     }
     else if (key == "symbols")
     {
-      item.symbols = convertYAMLStringList(doc, value_node);
+      symbols = value_node;
     }
     else if (key == "weak-def-symbols")
     {
-      item.weak_symbols = convertYAMLStringList(doc, value_node);
+      weak_symbols = value_node;
+    }
+    else if (key == "thread-local-symbols")
+    {
+      tlv_symbols = value_node;
     }
     else if (key == "objc-classes")
     {
-      item.objc_classes = convertYAMLStringList(doc, value_node);
+      objc_classes = value_node;
+    }
+    else if (key == "objc-eh-types")
+    {
+      objc_eh_types = value_node;
     }
     else if (key == "objc-ivars")
     {
-      item.objc_ivars = convertYAMLStringList(doc, value_node);
+      objc_ivars = value_node;
     }
     else if (key == "re-exports")
     {
-      item.reexports = convertYAMLStringList(doc, value_node);
+      reexports = value_node;
     }
   }
-  return item;
+
+  // Add the symbols in a fixed order that does not depend on the order of
+  // the keys in the file.
+  beginSection(d, kind, archMask);
+  appendYAMLSymbols(doc, symbols, SymbolKind::GlobalSymbol,
+    false, false, d);
+  appendYAMLSymbols(doc, weak_symbols, SymbolKind::GlobalSymbol,
+    true, false, d);
+  appendYAMLSymbols(doc, tlv_symbols, SymbolKind::GlobalSymbol,
+    false, true, d);
+  appendYAMLSymbols(doc, objc_classes, SymbolKind::ObjectiveCClass,
+    false, false, d);
+  appendYAMLSymbols(doc, objc_eh_types, SymbolKind::ObjectiveCClassEHType,
+    false, false, d);
+  appendYAMLSymbols(doc, objc_ivars, SymbolKind::ObjectiveCInstanceVariable,
+    false, false, d);
+  endSection(d);
+
+  if (kind == SectionKind::Export)
+  {
+    beginSection(d, SectionKind::Reexport, archMask);
+    appendYAMLSymbols(doc, reexports, SymbolKind::GlobalSymbol,
+      false, false, d);
+    endSection(d);
+  }
 }
 
-static std::vector<ExportItem> convertYAMLExportList(
-  yaml_document_t * doc, yaml_node_t * node)
+// Converts the "exports" or "undefineds" list.
+static void convertYAMLExportList(yaml_document_t * doc, yaml_node_t * node,
+  SectionKind kind, StubData & d)
 {
-  if (node->type != YAML_SEQUENCE_NODE) { return {}; }
-  std::vector<ExportItem> list;
+  if (node->type != YAML_SEQUENCE_NODE) { return; }
   yaml_node_item_t * start = node->data.sequence.items.start;
   yaml_node_item_t * top = node->data.sequence.items.top;
   for (yaml_node_item_t * i = start; i < top; i++)
   {
     yaml_node_t * node = yaml_document_get_node(doc, *i);
-    list.push_back(convertYAMLExportItem(doc, node));
+    convertYAMLExportItem(doc, node, kind, d);
+  }
+}
+
+// The limits are read for every file that is parsed, possibly on several
+// threads at once, so each one is kept in an atomic instead of behind a
+// lock.
+static std::atomic<size_t> maxInputSizeLimit(ParseLimits().maxInputSize);
+static std::atomic<size_t> maxNodeCountLimit(ParseLimits().maxNodeCount);
+static std::atomic<size_t> maxDepthLimit(ParseLimits().maxDepth);
+static std::atomic<size_t> maxAliasCountLimit(ParseLimits().maxAliasCount);
+
+void tapi::setParseLimits(const ParseLimits & limits) noexcept
+{
+  maxInputSizeLimit.store(limits.maxInputSize, std::memory_order_relaxed);
+  maxNodeCountLimit.store(limits.maxNodeCount, std::memory_order_relaxed);
+  maxDepthLimit.store(limits.maxDepth, std::memory_order_relaxed);
+  maxAliasCountLimit.store(limits.maxAliasCount, std::memory_order_relaxed);
+}
+
+ParseLimits tapi::getParseLimits() noexcept
+{
+  ParseLimits r;
+  r.maxInputSize = maxInputSizeLimit.load(std::memory_order_relaxed);
+  r.maxNodeCount = maxNodeCountLimit.load(std::memory_order_relaxed);
+  r.maxDepth = maxDepthLimit.load(std::memory_order_relaxed);
+  r.maxAliasCount = maxAliasCountLimit.load(std::memory_order_relaxed);
+  return r;
+}
+
+static std::string describeYAMLError(const yaml_parser_t & parser)
+{
+  std::string r = "YAML syntax error";
+  if (parser.problem)
+  {
+    r += ": " + std::string(parser.problem) + " at line " +
+      std::to_string(parser.problem_mark.line + 1);
+  }
+  return r + ".";
+}
+
+// Loads the first YAML document of the input, like yaml_parser_load, while
+// making sure that it is within the limits.  The node count includes the
+// nodes that each alias would expand to, so the conversion work is bounded
+// by limits.maxNodeCount even for inputs with nested aliases that would
+// otherwise expand exponentially.  Like yaml_parser_load, we make each alias
+// share the node of its anchor instead of copying it.
+static void loadYAMLDocument(yaml_parser_t & parser,
+  const ParseLimits & limits, yaml_document_t & doc, std::string & error)
+{
+  if (!yaml_document_initialize(&doc, nullptr, nullptr, nullptr, 1, 1))
+  {
+    error = "Failed to initialize YAML document.";
+    return;
+  }
+
+  // For each collection we are inside of: its node, the node count when it
+  // started, its anchor, and for a mapping, the key waiting for its value.
+  struct Collection
+  {
+    int node;
+    bool mapping;
+    size_t startNodeCount;
+    std::string anchor;
+    int key;
+  };
+  struct Anchor
+  {
+    int node;
+    size_t size;
+  };
+  std::vector<Collection> stack;
+  std::map<std::string, Anchor> anchors;
+  size_t nodeCount = 0;
+  size_t aliasCount = 0;
+  bool done = false;
+
+  while (!done && !error.size())
+  {
+    yaml_event_t event;
+    if (!yaml_parser_parse(&parser, &event))
+    {
+      error = describeYAMLError(parser);
+      break;
+    }
+
+    // The node that this event adds to the collection we are inside of.
+    int node = 0;
+    bool starting = false;
+
+    switch (event.type)
+    {
+    case YAML_SCALAR_EVENT:
+      nodeCount++;
+      if (event.data.scalar.length > INT_MAX)
+      {
+        error = "YAML scalar is too long.";
+        break;
+      }
+      node = yaml_document_add_scalar(&doc, nullptr, event.data.scalar.value,
+        (int)event.data.scalar.length, event.data.scalar.style);
+      if (node && event.data.scalar.anchor)
+      {
+        anchors[(const char *)event.data.scalar.anchor] = { node, 1 };
+      }
+      break;
+
+    case YAML_SEQUENCE_START_EVENT:
+    case YAML_MAPPING_START_EVENT:
+    {
+      const yaml_char_t * anchor;
+      if (event.type == YAML_SEQUENCE_START_EVENT)
+      {
+        anchor = event.data.sequence_start.anchor;
+        node = yaml_document_add_sequence(&doc, nullptr,
+          event.data.sequence_start.style);
+      }
+      else
+      {
+        anchor = event.data.mapping_start.anchor;
+        node = yaml_document_add_mapping(&doc, nullptr,
+          event.data.mapping_start.style);
+      }
+      starting = true;
+      nodeCount++;
+      if (stack.size() >= limits.maxDepth)
+      {
+        error = "YAML nesting is too deep (the limit is " +
+          std::to_string(limits.maxDepth) + ").";
+      }
+      else if (node)
+      {
+        stack.push_back({ node, event.type == YAML_MAPPING_START_EVENT,
+          nodeCount - 1,
+          anchor ? std::string((const char *)anchor) : std::string(), 0 });
+      }
+      break;
+    }
+
+    case YAML_SEQUENCE_END_EVENT:
+    case YAML_MAPPING_END_EVENT:
+      if (stack.size())
+      {
+        const Collection & c = stack.back();
+        if (c.anchor.size())
+        {
+          anchors[c.anchor] = { c.node, nodeCount - c.startNodeCount };
+        }
+        stack.pop_back();
+      }
+      break;
+
+    case YAML_ALIAS_EVENT:
+    {
+      aliasCount++;
+      if (aliasCount > limits.maxAliasCount)
+      {
+        error = "YAML document has too many aliases (the limit is " +
+          std::to_string(limits.maxAliasCount) + ").";
+        break;
+      }
+      auto it = anchors.find((const char *)event.data.alias.anchor);
+      if (it == anchors.end())
+      {
+        error = "YAML alias refers to an unknown or unfinished anchor.";
+        break;
+      }
+      nodeCount += it->second.size;
+      node = it->second.node;
+      break;
+    }
+
+    case YAML_DOCUMENT_END_EVENT:
+    case YAML_STREAM_END_EVENT:
+      done = true;
+      break;
+
+    default:
+      break;
+    }
+
+    if (!error.size() && nodeCount > limits.maxNodeCount)
+    {
+      error = "YAML document has too many nodes, counting the expansion "
+        "of aliases (the limit is " + std::to_string(limits.maxNodeCount) +
+        ").";
+    }
+
+    bool adding = event.type == YAML_SCALAR_EVENT ||
+      event.type == YAML_ALIAS_EVENT || starting;
+    if (!error.size() && adding && !node)
+    {
+      error = "Failed to build YAML document.";
+    }
+
+    // Add the node to its parent.  A new collection is already on top of
+    // the stack, so its parent is the one under it.  The first node added
+    // to the document is the root.
+    size_t parentIndex = stack.size() - (starting ? 1 : 0);
+    if (!error.size() && adding && parentIndex > 0)
+    {
+      Collection & parent = stack[parentIndex - 1];
+      int success;
+      if (!parent.mapping)
+      {
+        success = yaml_document_append_sequence_item(&doc, parent.node, node);
+      }
+      else if (parent.key == 0)
+      {
+        parent.key = node;
+        success = 1;
+      }
+      else
+      {
+        success = yaml_document_append_mapping_pair(&doc, parent.node,
+          parent.key, node);
+        parent.key = 0;
+      }
+      if (!success) { error = "Failed to build YAML document."; }
+    }
+
+    yaml_event_delete(&event);
   }
-  return list;
 }
 
 static StubData parseYAML(const uint8_t * data, size_t size,
@@ -285,7 +802,15 @@ static StubData parseYAML(const uint8_t * data, size_t size,
   r.currentVersion = { 1, 0, 0 };
   r.compatVersion = { 1, 0, 0 };
 
+  ParseLimits limits = getParseLimits();
+  if (size > limits.maxInputSize)
+  {
+    error = "YAML input is too large (" + std::to_string(size) +
+      " bytes; the limit is " + std::to_string(limits.maxInputSize) + ").";
+  }
+
   yaml_parser_t parser;
+  memset(&parser, 0, sizeof(parser));
   if (!error.size())
   {
     int success = yaml_parser_initialize(&parser);
@@ -296,22 +821,19 @@ static StubData parseYAML(const uint8_t * data, size_t size,
   }
 
   yaml_document_t doc;
+  memset(&doc, 0, sizeof(doc));
   if (!error.size())
   {
     yaml_parser_set_input_string(&parser, data, size);
-    int success = yaml_parser_load(&parser, &doc);
-    if (!success)
-    {
-      error = "Failed to initialize YAML parser.";
-    }
+    loadYAMLDocument(parser, limits, doc, error);
   }
 
   // Get the root node and make sure it is a mapping.
-  yaml_node_t * root;
+  yaml_node_t * root = nullptr;
   if (!error.size())
   {
     root = yaml_document_get_root_node(&doc);
-    if (root->type != YAML_MAPPING_NODE)
+    if (root == nullptr || root->type != YAML_MAPPING_NODE)
     {
       error = "YAML root node is not a mapping.";
     }
@@ -319,6 +841,7 @@ static StubData parseYAML(const uint8_t * data, size_t size,
 
   if (!error.size())
   {
+    std::set<std::string> seenKeys;
     yaml_node_pair_t * start = root->data.mapping.pairs.start;
     yaml_node_pair_t * top = root->data.mapping.pairs.top;
     for (yaml_node_pair_t * pair = start; pair < top; pair++)
@@ -334,13 +857,20 @@ static StubData parseYAML(const uint8_t * data, size_t size,
 
       std::string key = convertYAMLString(key_node);
 
+      // Like Apple's TAPI, we reject duplicate keys.
+      if (!seenKeys.insert(key).second)
+      {
+        error = "Root mapping has a duplicate key: " + key + ".";
+        break;
+      }
+
       if (key == "platform")
       {
         r.platform = convertYAMLPlatform(value_node);
       }
       else if (key == "install-name")
       {
-        r.installName = convertYAMLString(value_node);
+        r.installName = convertYAMLStubString(value_node);
       }
       else if (key == "archs")
       {
@@ -348,11 +878,11 @@ static StubData parseYAML(const uint8_t * data, size_t size,
       }
       else if (key == "exports")
       {
-        r.exports = convertYAMLExportList(&doc, value_node);
+        convertYAMLExportList(&doc, value_node, SectionKind::Export, r);
       }
       else if (key == "undefineds")
       {
-        r.undefineds = convertYAMLExportList(&doc, value_node);
+        convertYAMLExportList(&doc, value_node, SectionKind::Undefined, r);
       }
       else if (key == "current-version")
       {
@@ -379,216 +909,866 @@ static StubData parseYAML(const uint8_t * data, size_t size,
       {
         parseYAMLFlagList(&doc, value_node, r);
       }
-      // TODO: uuids
+      else if (key == "uuids")
+      {
+        r.uuids = convertYAMLUUIDList(&doc, value_node);
+      }
     }
   }
 
   yaml_parser_delete(&parser);
   yaml_document_delete(&doc);
 
+  sortHideCommands(r);
   return r;
 }
 
-bool LinkerInterfaceFile::isSupported(const std::string & path,
-  const uint8_t * data, size_t size) noexcept
-{
-  (void)path;
-  return detectYAML(data, size);
-}
-
-bool LinkerInterfaceFile::shouldPreferTextBasedStubFile(
-  const std::string & path) noexcept
+static Platform convertMachOPlatform(uint32_t platform)
 {
-  (void)path;
-  // Note: The original library would actually load the file and check
-  // "isInstallAPI()".  Not sure how important it is to do all that work so
-  // let's just return false for now to match the observed behavior of
-  // Apple TAPI.
-  return false;
+  switch (platform)
+  {
+  case 1: return Platform::OSX;
+  case 2: return Platform::iOS;
+  case 3: return Platform::tvOS;
+  case 4: return Platform::watchOS;
+  case 5: return Platform::bridgeOS;
+  default: return Platform::Unknown;
+  }
 }
 
-bool LinkerInterfaceFile::areEquivalent(const std::string & tbdPath,
-  const std::string & dylibPath) noexcept
+static bool isMachODylib(const MachOFile & file)
 {
-  // Let's see if the linker actually ever calls this in practice.
-  std::cerr << "tinytapi: fatal: Received call to areEquivalent" << std::endl;
-  std::cerr << "  tbd:   " << tbdPath << std::endl;
-  std::cerr << "  dylib: " << dylibPath << std::endl;
-  abort();
-
-  // TODO: Load both files and check to see if they have some UUIDs in
-  // common or something.
-  return false;
+  return file.fileType() == MH_DYLIB || file.fileType() == MH_DYLIB_STUB;
 }
 
-void LinkerInterfaceFile::init(const StubData & d,
+// Reads a dylib (thin or fat) in place.  Only the slice for the selected
+// architecture is examined beyond its fat header entry, and of that slice
+// only the load commands and the export trie are read.
+static StubData parseMachO(const uint8_t * data, size_t size,
   cpu_type_t cpuType, cpu_subtype_t cpuSubType,
-  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
-  std::string & error)
+  CpuSubTypeMatching matchingMode, std::string & error)
 {
-  platform = d.platform;
-  installName = d.installName;
-  currentVersion = d.currentVersion;
-  compatVersion = d.compatVersion;
-  swiftVersion = d.swiftVersion;
-  applicationExtensionSafe = d.applicationExtensionSafe;
-  twoLevelNamespace = d.twoLevelNamespace;
+  StubData r;
 
-  Architecture cpuArch = getCpuArch(cpuType, cpuSubType);
-  if (cpuArch == Architecture::None)
+  // Slices with architectures we don't know about are left out.
+  std::vector<MachOSlice> slices;
+  for (const MachOSlice & slice : getMachOSlices(data, size))
   {
-    error = "Unrecognized desired architecture.";
-    return;
+    Architecture arch = getCpuArch(slice.cpuType, slice.cpuSubType);
+    if (arch == Architecture::None) { continue; }
+    slices.push_back(slice);
+    r.archs.push_back(arch);
   }
 
+  // Let init report an unrecognized or missing architecture.
+  Architecture wantedArch = getCpuArch(cpuType, cpuSubType);
+  if (wantedArch == Architecture::None) { return r; }
   bool enforceCpuSubType = matchingMode == CpuSubTypeMatching::Exact;
   Architecture selectedArch = pickArchitecture(
-    cpuArch, enforceCpuSubType, d.archs);
-  if (selectedArch == Architecture::None)
+    wantedArch, enforceCpuSubType, r.archs);
+  if (selectedArch == Architecture::None) { return r; }
+
+  size_t index = std::find(r.archs.begin(), r.archs.end(), selectedArch) -
+    r.archs.begin();
+  MachOFile file;
+  if (!file.init(slices[index]) ||
+    getCpuArch(file.cpuType(), file.cpuSubType()) != selectedArch)
   {
-    error = "missing required architecture " +
-      std::string(getArchInfo(cpuArch).name) + " in file " +
-      d.filename;
-    return;
+    error = "Malformed Mach-O file.";
+    return r;
   }
 
-  for (const ExportItem & item : d.exports)
+  if (!isMachODylib(file))
   {
-    if (!item.hasArch(selectedArch)) { continue; }
+    error = "Mach-O file is not a dynamic library.";
+    return r;
+  }
 
-    for (const std::string & name : item.symbols)
-    {
-      exportList.push_back(name);
-    }
+  r.twoLevelNamespace = file.flags() & MH_TWOLEVEL;
+  r.applicationExtensionSafe = file.flags() & MH_APP_EXTENSION_SAFE;
 
-    for (const std::string & name : item.weak_symbols)
-    {
-      Symbol sym(name);
-      sym.weak = true;
-      exportList.push_back(sym);
-    }
+  uint32_t archMask = archBit(selectedArch);
+  const uint8_t * trie = nullptr;
+  size_t trieSize = 0;
 
-    for (const std::string & name : item.objc_classes)
+  beginSection(r, SectionKind::Reexport, archMask);
+  bool valid = file.forEachLoadCommand(
+    [&](uint32_t cmd, size_t offset, uint32_t cmdSize)
+  {
+    switch (cmd)
     {
-      exportList.push_back("_OBJC_CLASS_$_" + name);
-      exportList.push_back("_OBJC_METACLASS_$_" + name);
-    }
-
-    for (const std::string & name : item.objc_ivars)
+    case LC_ID_DYLIB:
+      if (cmdSize < 24) { return true; }
+      r.installName = file.readCommandString(offset, cmdSize,
+        file.read32(offset + 8)).c_str();
+      r.currentVersion = file.read32(offset + 16);
+      r.compatVersion = file.read32(offset + 20);
+      break;
+    case LC_REEXPORT_DYLIB:
     {
-      exportList.push_back("_OBJC_IVAR_$_" + name);
+      if (cmdSize < 24) { return true; }
+      std::string lib = file.readCommandString(offset, cmdSize,
+        file.read32(offset + 8));
+      addStubEntry(r, lib.c_str(), strlen(lib.c_str()),
+        SymbolKind::GlobalSymbol, false, false);
+      break;
     }
-
-    for (const std::string & lib : item.reexports)
-    {
-      reexports.push_back(lib);
+    case LC_DYLD_INFO:
+    case LC_DYLD_INFO_ONLY:
+      if (cmdSize < 48) { return true; }
+      trie = file.getData() + file.read32(offset + 40);
+      trieSize = file.read32(offset + 44);
+      if (file.read32(offset + 40) > file.getSize() ||
+        trieSize > file.getSize() - file.read32(offset + 40))
+      {
+        trie = nullptr;
+        trieSize = 0;
+        error = "Export trie is outside of the Mach-O file.";
+        return false;
+      }
+      break;
+    case LC_DYLD_EXPORTS_TRIE:
+      if (cmdSize < 16) { return true; }
+      trie = file.getData() + file.read32(offset + 8);
+      trieSize = file.read32(offset + 12);
+      if (file.read32(offset + 8) > file.getSize() ||
+        trieSize > file.getSize() - file.read32(offset + 8))
+      {
+        trie = nullptr;
+        trieSize = 0;
+        error = "Export trie is outside of the Mach-O file.";
+        return false;
+      }
+      break;
+    case LC_VERSION_MIN_MACOSX:
+      r.platform = Platform::OSX;
+      break;
+    case LC_VERSION_MIN_IPHONEOS:
+      r.platform = Platform::iOS;
+      break;
+    case LC_VERSION_MIN_TVOS:
+      r.platform = Platform::tvOS;
+      break;
+    case LC_VERSION_MIN_WATCHOS:
+      r.platform = Platform::watchOS;
+      break;
+    case LC_BUILD_VERSION:
+      if (cmdSize < 12) { return true; }
+      r.platform = convertMachOPlatform(file.read32(offset + 8));
+      break;
     }
+    return true;
+  });
+  endSection(r);
+  if (error.size()) { return r; }
+  if (!valid)
+  {
+    error = "Malformed Mach-O load commands.";
+    return r;
   }
 
-  for (const ExportItem & item : d.undefineds)
+  beginSection(r, SectionKind::Export, archMask);
+  valid = walkExportTrie(trie, trieSize,
+    [&](const std::string & name, uint64_t flags)
   {
-    if (!item.hasArch(selectedArch)) { continue; }
+    bool weak = flags & EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION;
+    bool threadLocal = (flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) ==
+      EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL;
+    addStubEntry(r, name.data(), name.size(), SymbolKind::GlobalSymbol,
+      weak, threadLocal);
+  });
+  endSection(r);
+  if (!valid)
+  {
+    error = "Malformed export trie.";
+    return r;
+  }
+
+  sortHideCommands(r);
+  return r;
+}
 
-    // NOTE: A lot of the code in this loop is duplicated from the
-    // loop above for d.exports.
+bool LinkerInterfaceFile::isSupported(const std::string & path,
+  const uint8_t * data, size_t size) noexcept
+{
+  (void)path;
+  if (detectYAML(data, size)) { return true; }
 
-    for (const std::string & name : item.symbols)
+  // Like parseMachO, ignore slices with architectures we don't know about.
+  if (detectMachO(data, size))
+  {
+    bool found = false;
+    for (const MachOSlice & slice : getMachOSlices(data, size))
     {
-      undefinedList.push_back(name);
+      if (getCpuArch(slice.cpuType, slice.cpuSubType) == Architecture::None)
+      {
+        continue;
+      }
+      MachOFile file;
+      if (!file.init(slice) || !isMachODylib(file)) { return false; }
+      found = true;
     }
+    return found;
+  }
+
+  return false;
+}
+
+// ld64 asks about every TBD file it comes across, so we remember the
+// answers.  An entry is only used if the file still has the same inode,
+// size, and modification time as the file we read to get the answer.
+struct PreferTextEntry
+{
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  time_t modified;
+  bool result;
+};
+
+static std::mutex preferTextMutex;
+static std::map<std::string, PreferTextEntry> preferTextCache;
+
+static bool hasInstallAPIFlag(const MappedFile & file)
+{
+  if (!detectYAML(file.data(), file.size())) { return false; }
+
+  HeaderAnswer answer = scanForInstallAPIFlag(file.data(), file.size());
+  if (answer != HeaderAnswer::Unknown) { return answer == HeaderAnswer::Yes; }
+
+  std::string error;
+  StubData d = parseYAML(file.data(), file.size(), error);
+  return error.empty() && d.installAPI;
+}
+
+// Returns true if the TBD file was made by installapi, like the original
+// library.  Usually this only needs the first few lines of the file.
+bool LinkerInterfaceFile::shouldPreferTextBasedStubFile(
+  const std::string & path) noexcept
+{
+  struct stat st;
+  if (stat(path.c_str(), &st)) { return false; }
 
-    for (const std::string & name : item.weak_symbols)
+  {
+    std::lock_guard<std::mutex> lock(preferTextMutex);
+    auto it = preferTextCache.find(path);
+    if (it != preferTextCache.end())
     {
-      Symbol sym(name);
-      sym.weak = true;
-      undefinedList.push_back(sym);
+      const PreferTextEntry & entry = it->second;
+      if (entry.device == st.st_dev && entry.inode == st.st_ino &&
+        entry.size == st.st_size && entry.modified == st.st_mtime)
+      {
+        return entry.result;
+      }
     }
+  }
 
-    for (const std::string & name : item.objc_classes)
+  // The file might have been replaced since we called stat, so the cache
+  // entry uses the status of the file we actually read.
+  MappedFile file;
+  if (!file.open(path)) { return false; }
+  bool result = hasInstallAPIFlag(file);
+  const struct stat & read = file.status();
+
+  std::lock_guard<std::mutex> lock(preferTextMutex);
+  preferTextCache[path] = { read.st_dev, read.st_ino, read.st_size,
+    read.st_mtime, result };
+  return result;
+}
+
+// Reads the install name and UUIDs of a TBD file.  These are in the header,
+// so usually we don't need to parse the whole file.
+static bool readStubIdentity(const MappedFile & tbd, std::string & installName,
+  StubVector<ArchUUID> & uuids)
+{
+  StubHeader header;
+  if (scanStubHeader(tbd.data(), tbd.size(), header))
+  {
+    installName = header.installName;
+    for (const std::string & entry : header.uuids)
     {
-      undefinedList.push_back("_OBJC_CLASS_$_" + name);
-      undefinedList.push_back("_OBJC_METACLASS_$_" + name);
+      ArchUUID uuid;
+      if (parseUUIDEntry(StubString(entry.data(), entry.size()), uuid))
+      {
+        uuids.push_back(uuid);
+      }
     }
+    return true;
+  }
 
-    for (const std::string & name : item.objc_ivars)
+  std::string error;
+  StubData d = parseYAML(tbd.data(), tbd.size(), error);
+  if (error.size()) { return false; }
+  installName = d.installName.c_str();
+  uuids = d.uuids;
+  return true;
+}
+
+// Returns true if the TBD file and the dylib have the same install name and
+// a UUID in common for some architecture.  For the dylib, we only read the
+// headers and load commands, so this is fast no matter how big it is.
+bool LinkerInterfaceFile::areEquivalent(const std::string & tbdPath,
+  const std::string & dylibPath) noexcept
+{
+  try
+  {
+    MappedFile tbd;
+    if (!tbd.open(tbdPath)) { return false; }
+    if (!detectYAML(tbd.data(), tbd.size())) { return false; }
+
+    std::string installName;
+    StubVector<ArchUUID> uuids;
+    if (!readStubIdentity(tbd, installName, uuids)) { return false; }
+    if (uuids.empty()) { return false; }
+
+    MappedFile dylib;
+    if (!dylib.open(dylibPath)) { return false; }
+
+    for (const MachOSlice & slice : getMachOSlices(dylib.data(), dylib.size()))
     {
-      undefinedList.push_back("_OBJC_IVAR_$_" + name);
+      MachOFile file;
+      uint8_t uuid[16];
+      std::string dylibInstallName;
+      if (!file.init(slice) || !file.getUUID(uuid)) { continue; }
+      if (!file.getInstallName(dylibInstallName) ||
+        dylibInstallName != installName)
+      {
+        continue;
+      }
+      Architecture arch = getCpuArch(file.cpuType(), file.cpuSubType());
+      for (const ArchUUID & entry : uuids)
+      {
+        if (entry.arch == arch && !memcmp(entry.uuid, uuid, 16))
+        {
+          return true;
+        }
+      }
     }
   }
+  catch (const std::bad_alloc &)
+  {
+  }
+  return false;
+}
 
-  std::set<std::string> hideSet;
+static bool sectionMatches(const StubSection & section, SectionKind kind,
+  Architecture arch)
+{
+  return section.kind == kind && (section.archMask & archBit(arch));
+}
 
-  for (const Symbol & sym : exportList)
+static std::string makeSymbolName(const char * prefix,
+  const char * name, size_t size)
+{
+  std::string r;
+  r.reserve(strlen(prefix) + size);
+  r.append(prefix).append(name, size);
+  return r;
+}
+
+// Appends the linker-level symbols for a TBD symbol.  An Objective-C class
+// turns into two symbols.
+static void addSymbols(std::vector<Symbol> & list, const StubData & d,
+  const StubSymbol & sym)
+{
+  const char * name = d.nameData(sym.name);
+  size_t size = sym.name.size;
+  switch (sym.kind)
+  {
+  case SymbolKind::GlobalSymbol:
+    list.emplace_back(std::string(name, size));
+    break;
+  case SymbolKind::ObjectiveCClass:
+    list.emplace_back(makeSymbolName("_OBJC_CLASS_$_", name, size),
+      sym.kind);
+    list.emplace_back(makeSymbolName("_OBJC_METACLASS_$_", name, size),
+      sym.kind);
+    break;
+  case SymbolKind::ObjectiveCClassEHType:
+    list.emplace_back(makeSymbolName("_OBJC_EHTYPE_$_", name, size),
+      sym.kind);
+    break;
+  case SymbolKind::ObjectiveCInstanceVariable:
+    list.emplace_back(makeSymbolName("_OBJC_IVAR_$_", name, size),
+      sym.kind);
+    break;
+  }
+  list.back().weak = sym.weak;
+  list.back().threadLocal = sym.threadLocal;
+}
+
+// For files with at least this many symbols for the selected architecture,
+// the symbols are materialized in chunks on several threads.
+static const size_t parallelSymbolThreshold = 16384;
+static const size_t symbolChunkSize = 4096;
+
+struct SymbolChunk
+{
+  const StubSymbol * begin;
+  const StubSymbol * end;
+  std::vector<Symbol> symbols;
+};
+
+// True on the worker threads of createBatch.  Those already keep all the
+// cores busy, so the files they load don't start threads of their own.
+static thread_local bool onBatchWorker = false;
+
+// Returns the number of threads that may be used to materialize symbols on
+// this thread, including this one.
+static unsigned symbolThreadLimit()
+{
+  if (onBatchWorker) { return 1; }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Appends the symbols of all the sections of the given kind that have the
+// given architecture to the list, using up to threadLimit threads.  The
+// result is the same whether or not threads are used.
+static void addAllSymbols(std::vector<Symbol> & list, const StubData & d,
+  SectionKind kind, Architecture arch, unsigned threadLimit)
+{
+  size_t count = 0;
+  for (const StubSection & section : d.sections)
   {
-    PackedVersion32 osVersion;
-    std::string hiddenName;
-    if (parseHideCommand(sym.name, osVersion, hiddenName) &&
-      osVersion >= minOSVersion)
+    if (sectionMatches(section, kind, arch)) { count += section.count; }
+  }
+
+  if (count < parallelSymbolThreshold || threadLimit < 2)
+  {
+    list.reserve(list.size() + count);
+    for (const StubSection & section : d.sections)
     {
-      hideSet.insert(hiddenName);
+      if (!sectionMatches(section, kind, arch)) { continue; }
+      const StubSymbol * begin = d.symbols.data() + section.first;
+      const StubSymbol * end = begin + section.count;
+      for (const StubSymbol * sym = begin; sym < end; sym++)
+      {
+        addSymbols(list, d, *sym);
+      }
     }
+    return;
   }
 
-  auto it = exportList.begin();
-  while (it != exportList.end())
+  std::vector<SymbolChunk> chunks;
+  for (const StubSection & section : d.sections)
   {
-    const Symbol & sym = *it;
-
-    if (sym.name.substr(0, 9) == "$ld$hide$")
+    if (!sectionMatches(section, kind, arch)) { continue; }
+    const StubSymbol * begin = d.symbols.data() + section.first;
+    const StubSymbol * end = begin + section.count;
+    for (const StubSymbol * p = begin; p < end; p += symbolChunkSize)
     {
-      it = exportList.erase(it);
+      size_t size = std::min<size_t>(symbolChunkSize, end - p);
+      chunks.push_back({ p, p + size, {} });
     }
-    else if (hideSet.count(sym.name))
+  }
+
+  std::atomic<size_t> nextChunk(0);
+  auto work = [&]()
+  {
+    size_t i;
+    while ((i = nextChunk++) < chunks.size())
     {
-      ignoreList.push_back(sym.name);
-      it = exportList.erase(it);
+      SymbolChunk & chunk = chunks[i];
+      chunk.symbols.reserve(chunk.end - chunk.begin);
+      for (const StubSymbol * sym = chunk.begin; sym < chunk.end; sym++)
+      {
+        addSymbols(chunk.symbols, d, *sym);
+      }
     }
-    else
+  };
+
+  // This thread works too, so the chunks all get done even if we fail to
+  // start any other threads.
+  size_t threadCount = std::min<size_t>(threadLimit, chunks.size());
+  std::vector<std::thread> threads;
+  try
+  {
+    for (size_t i = 1; i < threadCount; i++) { threads.emplace_back(work); }
+  }
+  catch (const std::system_error &)
+  {
+  }
+  work();
+  for (std::thread & thread : threads) { thread.join(); }
+
+  size_t total = list.size();
+  for (const SymbolChunk & chunk : chunks) { total += chunk.symbols.size(); }
+  list.reserve(total);
+  for (SymbolChunk & chunk : chunks)
+  {
+    std::move(chunk.symbols.begin(), chunk.symbols.end(),
+      std::back_inserter(list));
+  }
+}
+
+static void addReexports(std::vector<std::string> & reexports,
+  const StubData & d, Architecture arch)
+{
+  for (const StubSection & section : d.sections)
+  {
+    if (!sectionMatches(section, SectionKind::Reexport, arch)) { continue; }
+    for (size_t i = section.first; i < section.first + section.count; i++)
     {
-      ++it;
+      reexports.push_back(d.nameString(d.symbols[i].name));
     }
   }
+}
 
-  minOSVersion.setPatch(0);
+static void collectAllSymbols(const StubData & d, Architecture arch,
+  std::vector<Symbol> & exports, std::vector<Symbol> & undefineds,
+  std::vector<std::string> & reexports)
+{
+  unsigned threadLimit = symbolThreadLimit();
+  addAllSymbols(exports, d, SectionKind::Export, arch, threadLimit);
+  addAllSymbols(undefineds, d, SectionKind::Undefined, arch, threadLimit);
+  addReexports(reexports, d, arch);
 }
 
-LinkerInterfaceFile * LinkerInterfaceFile::create(const std::string & path,
+// Like collectAllSymbols, but only keeps the exports whose names are in the
+// wanted set, and skips undefined symbols entirely.  Since hide commands
+// were already extracted by the parser, we can stop as soon as every wanted
+// name has been found.
+static void collectWantedExports(const StubData & d, Architecture arch,
+  const std::set<std::string> & wanted,
+  std::vector<Symbol> & exports, std::vector<std::string> & reexports)
+{
+  std::set<const std::string *> found;
+  std::string candidate;
+
+  auto consider = [&](const std::string & name, const StubSymbol & sym)
+  {
+    auto it = wanted.find(name);
+    if (it == wanted.end()) { return; }
+    found.insert(&*it);
+    Symbol out(name, sym.kind);
+    out.weak = sym.weak;
+    out.threadLocal = sym.threadLocal;
+    exports.push_back(std::move(out));
+  };
+
+  auto considerPrefixed = [&](const char * prefix, const StubSymbol & sym)
+  {
+    candidate.assign(prefix).append(d.nameData(sym.name), sym.name.size);
+    consider(candidate, sym);
+  };
+
+  addReexports(reexports, d, arch);
+
+  for (const StubSection & section : d.sections)
+  {
+    if (found.size() == wanted.size()) { break; }
+    if (!sectionMatches(section, SectionKind::Export, arch)) { continue; }
+
+    const StubSymbol * begin = d.symbols.data() + section.first;
+    const StubSymbol * end = begin + section.count;
+    for (const StubSymbol * sym = begin; sym < end; sym++)
+    {
+      if (found.size() == wanted.size()) { break; }
+
+      switch (sym->kind)
+      {
+      case SymbolKind::GlobalSymbol:
+        candidate.assign(d.nameData(sym->name), sym->name.size);
+        consider(candidate, *sym);
+        break;
+      case SymbolKind::ObjectiveCClass:
+        considerPrefixed("_OBJC_CLASS_$_", *sym);
+        considerPrefixed("_OBJC_METACLASS_$_", *sym);
+        break;
+      case SymbolKind::ObjectiveCClassEHType:
+        considerPrefixed("_OBJC_EHTYPE_$_", *sym);
+        break;
+      case SymbolKind::ObjectiveCInstanceVariable:
+        considerPrefixed("_OBJC_IVAR_$_", *sym);
+        break;
+      }
+    }
+  }
+}
+
+// Parses a TBD file or Mach-O dylib.
+static StubData loadStubData(const std::string & path,
   const uint8_t * data, size_t size,
   cpu_type_t cpuType, cpu_subtype_t cpuSubType,
-  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
-  std::string & error) noexcept
+  CpuSubTypeMatching matchingMode, std::string & error)
 {
-  error.clear();
+  StubData d;
 
   if (path.empty())
   {
     error = "The path argument is empty.";
-    return nullptr;
+    return d;
   }
 
   if (data == nullptr)
   {
     error = "The data pointer is nullptr.";
-    return nullptr;
+    return d;
   }
 
-  StubData d;
-
   if (detectYAML(data, size))
   {
+    TAPI_PROBE3(parse__start, path.c_str(), size, 0);
     d = parseYAML(data, size, error);
   }
+  else if (detectMachO(data, size))
+  {
+    TAPI_PROBE3(parse__start, path.c_str(), size, 1);
+    d = parseMachO(data, size, cpuType, cpuSubType, matchingMode, error);
+  }
   else
   {
-    error = "File does not look like YAML; might be a binary.";
-    return nullptr;
+    error = "File is neither a TBD file nor a Mach-O dylib.";
+    return d;
+  }
+  if (!error.size() && d.tooManyNames)
+  {
+    error = "The symbol names take up more than 4 GiB.";
   }
   d.filename = path;
+  TAPI_PROBE3(parse__done, path.c_str(), d.symbols.size(), error.c_str());
+  return d;
+}
+
+static Architecture selectArchitecture(const StubData & d,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, std::string & error)
+{
+  Architecture cpuArch = getCpuArch(cpuType, cpuSubType);
+  if (cpuArch == Architecture::None)
+  {
+    error = "Unrecognized desired architecture.";
+    return Architecture::None;
+  }
+
+  bool enforceCpuSubType = matchingMode == CpuSubTypeMatching::Exact;
+  Architecture selectedArch = pickArchitecture(
+    cpuArch, enforceCpuSubType, d.archs);
+  TAPI_PROBE3(arch__select, d.filename.c_str(),
+    getArchInfo(cpuArch).name, getArchInfo(selectedArch).name);
+  if (selectedArch == Architecture::None)
+  {
+    error = "missing required architecture " +
+      std::string(getArchInfo(cpuArch).name) + " in file " +
+      d.filename;
+  }
+  return selectedArch;
+}
+
+// Returns the names hidden from clients targeting minOSVersion or later.
+// If wanted is not null, only names in it are returned.
+static std::set<std::string> getHiddenNames(const StubData & d,
+  Architecture arch, PackedVersion32 minOSVersion,
+  const std::set<std::string> * wanted)
+{
+  std::set<std::string> hideSet;
+  for (const HideCommand & command : d.hideCommands)
+  {
+    if (command.osVersion < minOSVersion) { break; }
+    if (!(command.archMask & archBit(arch))) { continue; }
+    std::string hiddenName = d.nameString(command.hiddenName);
+    if (wanted && !wanted->count(hiddenName)) { continue; }
+    hideSet.insert(std::move(hiddenName));
+  }
+  return hideSet;
+}
 
+void LinkerInterfaceFile::init(const StubData & d,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  const std::vector<std::string> * wantedSymbols, std::string & error)
+{
+  std::set<std::string> wantedSet;
+  const std::set<std::string> * wanted = nullptr;
+  if (wantedSymbols)
+  {
+    wantedSet.insert(wantedSymbols->begin(), wantedSymbols->end());
+    wanted = &wantedSet;
+  }
+
+  platform = d.platform;
+  installName = toStdString(d.installName);
+  currentVersion = d.currentVersion;
+  compatVersion = d.compatVersion;
+  swiftVersion = d.swiftVersion;
+  applicationExtensionSafe = d.applicationExtensionSafe;
+  twoLevelNamespace = d.twoLevelNamespace;
+
+  Architecture selectedArch = selectArchitecture(d, cpuType, cpuSubType,
+    matchingMode, error);
+  if (error.size()) { return; }
+
+  TAPI_PROBE3(materialize__start, d.filename.c_str(),
+    getArchInfo(selectedArch).name, wanted ? wanted->size() : 0);
+  if (wanted)
+  {
+    collectWantedExports(d, selectedArch, *wanted, exportList, reexports);
+  }
+  else
+  {
+    collectAllSymbols(d, selectedArch, exportList, undefinedList, reexports);
+  }
+  TAPI_PROBE3(materialize__done, d.filename.c_str(),
+    exportList.size(), undefinedList.size());
+
+  std::set<std::string> hideSet = getHiddenNames(d, selectedArch,
+    minOSVersion, wanted);
+
+  if (hideSet.size())
+  {
+    auto out = exportList.begin();
+    for (auto it = exportList.begin(); it != exportList.end(); ++it)
+    {
+      if (hideSet.count(it->name))
+      {
+        ignoreList.push_back(it->name);
+        continue;
+      }
+      if (out != it) { *out = std::move(*it); }
+      ++out;
+    }
+    exportList.erase(out, exportList.end());
+  }
+  TAPI_PROBE3(hide__done, d.filename.c_str(),
+    d.hideCommands.size(), ignoreList.size());
+
+  bloomInit(exportFilter, exportList.size());
+  for (const Symbol & sym : exportList)
+  {
+    bloomInsert(exportFilter, sym.name);
+  }
+
+  minOSVersion.setPatch(0);
+}
+
+static void sortAndMergeSymbols(std::vector<Symbol> & list)
+{
+  std::sort(list.begin(), list.end(),
+    [](const Symbol & a, const Symbol & b) { return a.name < b.name; });
+
+  auto out = list.begin();
+  for (auto it = list.begin(); it != list.end(); ++it)
+  {
+    if (out != list.begin() && (out - 1)->name == it->name)
+    {
+      Symbol & kept = *(out - 1);
+      kept.weak = kept.weak && it->weak;
+      kept.threadLocal = kept.threadLocal || it->threadLocal;
+      continue;
+    }
+    if (out != it) { *out = std::move(*it); }
+    ++out;
+  }
+  list.erase(out, list.end());
+}
+
+void LinkerInterfaceFile::sortSymbols() noexcept
+{
+  if (symbolsSorted) { return; }
+  sortAndMergeSymbols(exportList);
+  sortAndMergeSymbols(undefinedList);
+  symbolsSorted = true;
+}
+
+SymbolRange LinkerInterfaceFile::exportsWithPrefix(
+  const std::string & prefix) noexcept
+{
+  sortSymbols();
+
+  auto first = std::lower_bound(exportList.begin(), exportList.end(), prefix,
+    [](const Symbol & sym, const std::string & p) { return sym.name < p; });
+  auto last = std::partition_point(first, exportList.end(),
+    [&](const Symbol & sym)
+    {
+      return sym.name.compare(0, prefix.size(), prefix) == 0;
+    });
+  return SymbolRange(first, last);
+}
+
+bool LinkerInterfaceFile::mayExport(const std::string & name) const noexcept
+{
+  return bloomMayContain(exportFilter, name);
+}
+
+// Returns the number of bytes a string has on the heap, which is zero if it
+// is short enough to be stored inside the string object.
+static size_t heapUsage(const std::string & str)
+{
+  const char * data = str.data();
+  const char * self = (const char *)&str;
+  if (data >= self && data < self + sizeof(str)) { return 0; }
+  return str.capacity() + 1;
+}
+
+template <typename T>
+static size_t heapUsage(const std::vector<T> & list)
+{
+  return list.capacity() * sizeof(T);
+}
+
+static size_t heapUsage(const std::vector<std::string> & list)
+{
+  size_t r = list.capacity() * sizeof(std::string);
+  for (const std::string & str : list) { r += heapUsage(str); }
+  return r;
+}
+
+static size_t heapUsage(const std::vector<Symbol> & list)
+{
+  size_t r = list.capacity() * sizeof(Symbol);
+  for (const Symbol & sym : list) { r += heapUsage(sym.name); }
+  return r;
+}
+
+size_t LinkerInterfaceFile::memoryUsage() const noexcept
+{
+  return sizeof(*this) + heapUsage(installName) +
+    heapUsage(exportList) + heapUsage(undefinedList) +
+    heapUsage(reexports) + heapUsage(ignoreList) + heapUsage(exportFilter);
+}
+
+LinkerInterfaceFile * LinkerInterfaceFile::createImpl(
+  const std::string & path, const uint8_t * data, size_t size,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  const std::vector<std::string> * wanted, std::string & error) noexcept
+{
+  error.clear();
+
+  // Fires create__done however we return.
+  LinkerInterfaceFile * file = nullptr;
+  struct DoneProbe
+  {
+    const std::string & path;
+    LinkerInterfaceFile * & file;
+    const std::string & error;
+    ~DoneProbe()
+    {
+      TAPI_PROBE4(create__done, path.c_str(),
+        file ? file->exportList.size() : 0,
+        file ? file->undefinedList.size() : 0, error.c_str());
+    }
+  } doneProbe { path, file, error };
+  (void)doneProbe;
+  TAPI_PROBE4(create__start, path.c_str(), size, cpuType, cpuSubType);
+
+  StubData d = loadStubData(path, data, size, cpuType, cpuSubType,
+    matchingMode, error);
   if (error.size()) { return nullptr; }
 
+  file = createFromStubData(d, cpuType, cpuSubType, matchingMode,
+    minOSVersion, wanted, error);
+  return file;
+}
+
+LinkerInterfaceFile * LinkerInterfaceFile::createFromStubData(
+  const StubData & d, cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  const std::vector<std::string> * wanted, std::string & error)
+{
   LinkerInterfaceFile * file = new LinkerInterfaceFile();
-  file->init(d, cpuType, cpuSubType, matchingMode, minOSVersion, error);
+  file->init(d, cpuType, cpuSubType, matchingMode, minOSVersion, wanted,
+    error);
 
   if (error.size())
   {
@@ -598,3 +1778,288 @@ LinkerInterfaceFile * LinkerInterfaceFile::create(const std::string & path,
 
   return file;
 }
+
+uint64_t tapi::traceContentHash(const uint8_t * data, size_t size) noexcept
+{
+  return contentHash(data, size);
+}
+
+LinkerInterfaceFile * LinkerInterfaceFile::create(const std::string & path,
+  const uint8_t * data, size_t size,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  std::string & error) noexcept
+{
+  int trace = traceFile();
+  if (trace == -1)
+  {
+    return createImpl(path, data, size, cpuType, cpuSubType, matchingMode,
+      minOSVersion, nullptr, error);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  LinkerInterfaceFile * file = createImpl(path, data, size,
+    cpuType, cpuSubType, matchingMode, minOSVersion, nullptr, error);
+  auto duration = std::chrono::steady_clock::now() - start;
+  traceCreate(trace, path, data, size, cpuType, cpuSubType, matchingMode,
+    minOSVersion,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+  return file;
+}
+
+LinkerInterfaceFile * LinkerInterfaceFile::createForSymbols(
+  const std::string & path, const uint8_t * data, size_t size,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  const std::vector<std::string> & wantedSymbols,
+  std::string & error) noexcept
+{
+  return createImpl(path, data, size, cpuType, cpuSubType, matchingMode,
+    minOSVersion, &wantedSymbols, error);
+}
+
+// Calls f with each linker-level name for a TBD symbol.  Names that need a
+// prefix are built in buffer.
+template <typename F>
+static void forEachSymbolName(const StubData & d, const StubSymbol & sym,
+  std::string & buffer, F f)
+{
+  const char * name = d.nameData(sym.name);
+  size_t size = sym.name.size;
+  auto prefixed = [&](const char * prefix)
+  {
+    buffer.assign(prefix).append(name, size);
+    f(buffer.data(), buffer.size());
+  };
+
+  switch (sym.kind)
+  {
+  case SymbolKind::GlobalSymbol:
+    f(name, size);
+    break;
+  case SymbolKind::ObjectiveCClass:
+    prefixed("_OBJC_CLASS_$_");
+    prefixed("_OBJC_METACLASS_$_");
+    break;
+  case SymbolKind::ObjectiveCClassEHType:
+    prefixed("_OBJC_EHTYPE_$_");
+    break;
+  case SymbolKind::ObjectiveCInstanceVariable:
+    prefixed("_OBJC_IVAR_$_");
+    break;
+  }
+}
+
+bool LinkerInterfaceFile::visitSymbols(const std::string & path,
+  const uint8_t * data, size_t size,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  SymbolVisitor & visitor, std::string & error) noexcept
+{
+  error.clear();
+
+  StubData d = loadStubData(path, data, size, cpuType, cpuSubType,
+    matchingMode, error);
+  if (error.size()) { return false; }
+
+  Architecture arch = selectArchitecture(d, cpuType, cpuSubType,
+    matchingMode, error);
+  if (error.size()) { return false; }
+
+  std::set<std::string> hideSet = getHiddenNames(d, arch, minOSVersion,
+    nullptr);
+
+  std::string buffer, hiddenCandidate;
+  for (const StubSection & section : d.sections)
+  {
+    if (!sectionMatches(section, SectionKind::Export, arch)) { continue; }
+    const StubSymbol * begin = d.symbols.data() + section.first;
+    for (const StubSymbol * sym = begin; sym < begin + section.count; sym++)
+    {
+      forEachSymbolName(d, *sym, buffer,
+        [&](const char * name, size_t nameSize)
+      {
+        bool hidden = false;
+        if (hideSet.size())
+        {
+          hiddenCandidate.assign(name, nameSize);
+          hidden = hideSet.count(hiddenCandidate);
+        }
+        visitor.visitExport({ name, nameSize, sym->kind, sym->weak,
+          sym->threadLocal, hidden });
+      });
+    }
+  }
+
+  for (const StubSection & section : d.sections)
+  {
+    if (!sectionMatches(section, SectionKind::Undefined, arch)) { continue; }
+    const StubSymbol * begin = d.symbols.data() + section.first;
+    for (const StubSymbol * sym = begin; sym < begin + section.count; sym++)
+    {
+      forEachSymbolName(d, *sym, buffer,
+        [&](const char * name, size_t nameSize)
+      {
+        visitor.visitUndefined({ name, nameSize, sym->kind, sym->weak,
+          sym->threadLocal, false });
+      });
+    }
+  }
+
+  for (const StubSection & section : d.sections)
+  {
+    if (!sectionMatches(section, SectionKind::Reexport, arch)) { continue; }
+    const StubSymbol * begin = d.symbols.data() + section.first;
+    for (const StubSymbol * lib = begin; lib < begin + section.count; lib++)
+    {
+      visitor.visitReexport(d.nameData(lib->name), lib->name.size);
+    }
+  }
+
+  return true;
+}
+
+// Reads the files and calls load(index, data, error) for each one on a pool
+// of threads.  If the file could not be read, data is nullptr and error
+// says why.
+template <typename F>
+static void loadBatch(const std::vector<std::string> & paths, F load)
+{
+  std::vector<BatchFile> files(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) { files[i].path = &paths[i]; }
+
+  BatchQueue queue;
+  auto work = [&]()
+  {
+    size_t i;
+    while (queue.pop(i))
+    {
+      BatchFile & file = files[i];
+      bool buffered = file.loaded;
+      std::string error;
+      if (file.loaded || readWholeFile(file, error))
+      {
+        load(i, &file.data, error);
+      }
+      else
+      {
+        load(i, nullptr, error);
+      }
+      std::vector<uint8_t>().swap(file.data);
+      if (buffered) { queue.doneWithBuffer(); }
+    }
+  };
+
+  unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  try
+  {
+    for (unsigned i = 0; i < threadCount; i++)
+    {
+      threads.emplace_back([&]() { onBatchWorker = true; work(); });
+    }
+  }
+  catch (const std::system_error &)
+  {
+  }
+
+  // This thread does the reading.  It can only read ahead if there is some
+  // other thread to parse what it reads.
+  bool queued = false;
+#ifdef TAPI_HAVE_IO_URING
+  if (threads.size())
+  {
+    queued = readFilesWithIOURing(files, queue, 4 * threads.size());
+  }
+#endif
+  if (!queued)
+  {
+    for (size_t i = 0; i < files.size(); i++) { queue.push(i, false); }
+  }
+  queue.close();
+
+  if (threads.empty()) { work(); }
+  for (std::thread & thread : threads) { thread.join(); }
+}
+
+std::vector<BatchLoadResult> LinkerInterfaceFile::createBatch(
+  const std::vector<std::string> & paths,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion) noexcept
+{
+  std::vector<BatchLoadResult> results(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) { results[i].path = paths[i]; }
+
+  loadBatch(paths, [&](size_t i, const std::vector<uint8_t> * data,
+    const std::string & error)
+  {
+    BatchLoadResult & result = results[i];
+    if (data == nullptr)
+    {
+      result.errorMessage = error;
+      return;
+    }
+    result.file = create(paths[i], data->data(), data->size(),
+      cpuType, cpuSubType, matchingMode, minOSVersion, result.errorMessage);
+  });
+  return results;
+}
+
+std::vector<MultiArchLoadResult> LinkerInterfaceFile::createBatch(
+  const std::vector<std::string> & paths,
+  const std::vector<BatchArch> & archs,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion) noexcept
+{
+  std::vector<MultiArchLoadResult> results(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) { results[i].path = paths[i]; }
+
+  loadBatch(paths, [&](size_t i, const std::vector<uint8_t> * data,
+    const std::string & error)
+  {
+    MultiArchLoadResult & result = results[i];
+    if (data == nullptr)
+    {
+      result.errorMessage = error;
+      return;
+    }
+
+    const std::string & path = paths[i];
+    result.archs.resize(archs.size());
+    for (BatchLoadResult & archResult : result.archs)
+    {
+      archResult.path = path;
+    }
+
+    // Which slice of a Mach-O file gets parsed depends on the
+    // architecture, so those are loaded separately for each one.
+    if (!detectYAML(data->data(), data->size()) &&
+      detectMachO(data->data(), data->size()))
+    {
+      for (size_t k = 0; k < archs.size(); k++)
+      {
+        BatchLoadResult & archResult = result.archs[k];
+        archResult.file = create(path, data->data(), data->size(),
+          archs[k].cpuType, archs[k].cpuSubType, matchingMode, minOSVersion,
+          archResult.errorMessage);
+      }
+      return;
+    }
+
+    // For a TBD file, the architecture doesn't matter until init.
+    StubData d = loadStubData(path, data->data(), data->size(), 0, 0,
+      matchingMode, result.errorMessage);
+    if (result.errorMessage.size())
+    {
+      result.archs.clear();
+      return;
+    }
+    for (size_t k = 0; k < archs.size(); k++)
+    {
+      BatchLoadResult & archResult = result.archs[k];
+      archResult.file = createFromStubData(d, archs[k].cpuType,
+        archs[k].cpuSubType, matchingMode, minOSVersion, nullptr,
+        archResult.errorMessage);
+    }
+  });
+  return results;
+}
@@ -0,0 +1,61 @@
+// Recording of create calls, for replaying real workloads with
+// tapi-replay.
+//
+// If the TINYTAPI_TRACE environment variable is set to a file name, every
+// call to LinkerInterfaceFile::create appends one line to that file:
+//
+//   hash cpuType cpuSubType matching minOSVersion nanoseconds path
+//
+// The fields are separated by tabs.  hash is a 64-bit hash of the file
+// contents in hexadecimal (see contentHash), minOSVersion is the packed
+// 32-bit value, and path comes last so that it can contain any character
+// except a newline.  Each line is written with a single write to a file
+// opened with O_APPEND, so several processes can share one trace file.
+//
+// Only create is traced, which covers the single-architecture createBatch
+// since it calls create for each file.  createForSymbols is not traced, and
+// neither are the TBD files loaded by the multi-architecture createBatch,
+// which parses each one once for all of the architectures; its Mach-O files
+// go through create and are traced.
+
+static uint64_t contentHash(const uint8_t * data, size_t size)
+{
+  return bloomHash((const char *)data, size);
+}
+
+// Returns the file descriptor of the trace file, or -1 if tracing is off.
+static int traceFile()
+{
+  static const int fd = []()
+  {
+    const char * path = getenv("TINYTAPI_TRACE");
+    if (path == nullptr || path[0] == 0) { return -1; }
+    return open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  }();
+  return fd;
+}
+
+static void traceCreate(int fd, const std::string & path,
+  const uint8_t * data, size_t size,
+  cpu_type_t cpuType, cpu_subtype_t cpuSubType,
+  CpuSubTypeMatching matchingMode, PackedVersion32 minOSVersion,
+  uint64_t nanoseconds)
+{
+  // Paths with newlines would break the format, and nobody has them.
+  if (path.find('\n') != std::string::npos) { return; }
+
+  char fields[128];
+  snprintf(fields, sizeof(fields), "%016llx\t%d\t%d\t%u\t%u\t%llu\t",
+    (unsigned long long)contentHash(data, size), (int)cpuType,
+    (int)cpuSubType, (unsigned)matchingMode, (unsigned)minOSVersion,
+    (unsigned long long)nanoseconds);
+
+  std::string line = fields;
+  line += path;
+  line += '\n';
+  ssize_t r;
+  do
+  {
+    r = write(fd, line.data(), line.size());
+  } while (r < 0 && errno == EINTR);
+}
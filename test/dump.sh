@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Runs tapi-dump on each TBD file and dylib in the test directory and
+# compares the output to the expected output in test/expected.  With
+# --update, writes the expected output instead.
+#
+# Usage: test/dump.sh [--update] [path/to/tapi-dump]
+#
+# Run this from the root of the repository, since the output includes the
+# file names.
+
+set -u
+UPDATE=
+if [ "${1:-}" = "--update" ]; then
+  UPDATE=1
+  shift
+fi
+DUMP="${1:-./tapi-dump}"
+status=0
+
+for f in test/*.tbd test/*.dylib; do
+  expected="test/expected/$(basename "$f").txt"
+  if [ -n "$UPDATE" ]; then
+    "$DUMP" "$f" > "$expected"
+    continue
+  fi
+  if "$DUMP" "$f" | diff -u "$expected" - > /dev/null; then
+    echo "ok: $f"
+  else
+    echo "FAIL: $f: output differs from $expected"
+    status=1
+  fi
+done
+
+exit $status
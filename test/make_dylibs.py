@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+
+# Writes the small Mach-O dylibs in this directory that are used to test
+# reading dylibs:
+#
+#   libthin.dylib  A thin x86_64 dylib.
+#   libfat.dylib   A fat dylib with x86_64 and x86_64h slices, and an arm64
+#                  slice that is not valid, which should be ignored unless
+#                  arm64 is selected.
+#
+# Usage: test/make_dylibs.py
+
+import os
+import struct
+
+CPU_TYPE_X86_64 = 0x01000007
+CPU_TYPE_ARM64 = 0x0100000c
+CPU_SUBTYPE_X86_64_ALL = 3
+CPU_SUBTYPE_X86_64_H = 8
+
+EXPORT_WEAK = 0x04
+EXPORT_THREAD_LOCAL = 0x01
+
+def uleb128(n):
+    out = b''
+    while True:
+        byte = n & 0x7f
+        n >>= 7
+        if n:
+            out += bytes([byte | 0x80])
+        else:
+            return out + bytes([byte])
+
+# An export trie where the root has one edge for each symbol.
+def export_trie(symbols):
+    offsets = [0] * len(symbols)
+    while True:
+        root = b'\x00' + bytes([len(symbols)])
+        for (name, _), offset in zip(symbols, offsets):
+            root += name.encode() + b'\x00' + uleb128(offset)
+        body = b''
+        new_offsets = []
+        for name, flags in symbols:
+            new_offsets.append(len(root) + len(body))
+            terminal = uleb128(flags) + uleb128(0x1000)
+            body += uleb128(len(terminal)) + terminal + b'\x00'
+        if new_offsets == offsets:
+            return root + body
+        offsets = new_offsets
+
+def dylib_command(cmd, name, current=0x10203, compat=0x10000):
+    data = name.encode() + b'\x00'
+    data += b'\x00' * (-(24 + len(data)) % 8)
+    return struct.pack('<6I', cmd, 24 + len(data), 24, 2, current, compat) + data
+
+def dylib(cpu_type, cpu_subtype, uuid, install_name, symbols,
+          reexports=[], exports_trie_command=False):
+    commands = [struct.pack('<II16s', 0x1b, 24, uuid)]
+    commands.append(dylib_command(0xd, install_name))
+    for name in reexports:
+        commands.append(dylib_command(0x8000001f, name))
+    # LC_BUILD_VERSION for macOS 10.12, with the 10.14 SDK.
+    commands.append(struct.pack('<6I', 0x32, 24, 1, 0x000a0c00,
+                                0x000a0e00, 0))
+    trie = export_trie(symbols)
+    trie_command_size = 16 if exports_trie_command else 48
+    commands_size = sum(len(c) for c in commands) + trie_command_size
+    trie_offset = 32 + commands_size
+    if exports_trie_command:
+        commands.append(struct.pack('<4I', 0x80000033, 16,
+                                    trie_offset, len(trie)))
+    else:
+        commands.append(struct.pack('<12I', 0x80000022, 48, 0, 0, 0, 0,
+                                    0, 0, 0, 0, trie_offset, len(trie)))
+    flags = 0x80 | 0x02000000  # MH_TWOLEVEL | MH_APP_EXTENSION_SAFE
+    header = struct.pack('<8I', 0xfeedfacf, cpu_type, cpu_subtype, 6,
+                         len(commands), commands_size, flags, 0)
+    return header + b''.join(commands) + trie
+
+def fat(slices):
+    alignment = 8
+    offset = 8 + 20 * len(slices)
+    header = struct.pack('>II', 0xcafebabe, len(slices))
+    body = b''
+    for cpu_type, cpu_subtype, data in slices:
+        header += struct.pack('>5I', cpu_type, cpu_subtype,
+                              offset + len(body), len(data), 3)
+        body += data + b'\x00' * (-len(data) % alignment)
+    return header + body
+
+symbols = [
+    ('_foo_create', 0),
+    ('_foo_weak', EXPORT_WEAK),
+    ('_foo_tlv', EXPORT_THREAD_LOCAL),
+    ('_OBJC_CLASS_$_Foo', 0),
+    ('_foo_old', 0),
+    ('$ld$hide$os10.12$_foo_old', 0),
+]
+uuid = bytes.fromhex('4C4C44535555314' + '4A1B5A08A0C9A8FD8')
+uuid_h = bytes.fromhex('00112233445566778899AABBCCDDEEFF')
+
+directory = os.path.dirname(os.path.abspath(__file__))
+
+with open(os.path.join(directory, 'libthin.dylib'), 'wb') as f:
+    f.write(dylib(CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL, uuid,
+                  '/usr/lib/libthin.dylib', symbols,
+                  ['/usr/lib/libreexported.dylib']))
+
+with open(os.path.join(directory, 'libfat.dylib'), 'wb') as f:
+    f.write(fat([
+        (CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL,
+         dylib(CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL, uuid,
+               '/usr/lib/libfat.dylib', symbols,
+               exports_trie_command=True)),
+        (CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_H,
+         dylib(CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_H, uuid_h,
+               '/usr/lib/libfat.dylib', symbols[:1])),
+        (CPU_TYPE_ARM64, 0, b'not a Mach-O file'),
+    ]))
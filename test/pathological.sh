@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Runs tapi-dump on each input in test/pathological and checks that every
+# architecture fails to load with an error message, quickly.
+#
+# Usage: test/pathological.sh [path/to/tapi-dump]
+
+set -u
+DUMP="${1:-./tapi-dump}"
+DIR="$(dirname "$0")/pathological"
+status=0
+
+for f in "$DIR"/*.tbd; do
+  start=$(date +%s%N)
+  if ! output=$(timeout 5 "$DUMP" "$f" 2>&1); then
+    echo "FAIL: $f: crashed or took more than 5 seconds"
+    status=1
+    continue
+  fi
+  ms=$(( ($(date +%s%N) - start) / 1000000 ))
+  if grep -q "^install-name:" <<< "$output"; then
+    echo "FAIL: $f: was accepted"
+    status=1
+    continue
+  fi
+  echo "ok: $f (${ms} ms)"
+done
+
+exit $status
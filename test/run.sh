@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# Runs all the tests on the programs built by build.sh.
+#
+# Usage: test/run.sh  (from the root of the repository)
+
+set -u
+status=0
+./tapi-test || status=1
+test/dump.sh ./tapi-dump || status=1
+test/pathological.sh ./tapi-dump || status=1
+exit $status
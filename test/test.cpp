@@ -0,0 +1,793 @@
+// Tests for the behavior that is not covered by comparing the output of
+// tapi-dump.  This includes the library source directly so that it can also
+// test internal functions.
+//
+// Usage: tapi-test  (from the root of the repository)
+
+#include "../src/tapi.cpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static unsigned failureCount = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static void check(bool condition, const char * text,
+  const char * file, int line)
+{
+  if (condition) { return; }
+  std::cout << file << ":" << line << ": check failed: " << text << std::endl;
+  failureCount++;
+}
+
+static std::string readFile(const std::string & path)
+{
+  std::ifstream stream(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << stream.rdbuf();
+  CHECK(stream.good());
+  return contents.str();
+}
+
+static LinkerInterfaceFile * load(const std::string & path,
+  const std::string & data, std::string & error,
+  cpu_type_t cpuType = CPU_TYPE_X86_64,
+  cpu_subtype_t cpuSubType = CPU_SUBTYPE_X86_64_ALL)
+{
+  return LinkerInterfaceFile::create(path, (const uint8_t *)data.data(),
+    data.size(), cpuType, cpuSubType, CpuSubTypeMatching::ABI_Compatible,
+    PackedVersion32(10, 11, 0), error);
+}
+
+// Makes a TBD file for x86_64 with the given number of symbols.
+static std::string makeStub(size_t symbolCount)
+{
+  std::string r = "--- !tapi-tbd-v2\narchs: [ x86_64 ]\nplatform: macosx\n"
+    "install-name: /usr/lib/libmany.dylib\nexports:\n"
+    "  - archs: [ x86_64 ]\n    symbols: [ ";
+  for (size_t i = 0; i < symbolCount; i++)
+  {
+    if (i) { r += ", "; }
+    r += "_symbol" + std::to_string(i);
+  }
+  r += " ]\n    objc-classes: [ Foo, Bar ]\n...\n";
+  return r;
+}
+
+static void testMayExport()
+{
+  std::vector<std::string> stubs = {
+    readFile("test/libfoo.tbd"),
+    readFile("test/libobjc.tbd"),
+    makeStub(20000),
+  };
+  for (const std::string & stub : stubs)
+  {
+    std::string error;
+    LinkerInterfaceFile * file = load("test.tbd", stub, error);
+    CHECK(file != nullptr);
+    if (file == nullptr) { continue; }
+
+    // No false negatives.
+    for (const Symbol & sym : file->exports())
+    {
+      CHECK(file->mayExport(sym.getName()));
+    }
+
+    // A false positive rate in the right ballpark.
+    if (file->exports().size() > 1000)
+    {
+      size_t positives = 0, queries = 100000;
+      for (size_t i = 0; i < queries; i++)
+      {
+        positives += file->mayExport("_absent" + std::to_string(i));
+      }
+      CHECK(positives < queries * 2 / 100);
+    }
+    delete file;
+  }
+}
+
+static std::vector<std::string> exportNames(const LinkerInterfaceFile & file)
+{
+  std::vector<std::string> names;
+  for (const Symbol & sym : file.exports()) { names.push_back(sym.getName()); }
+  return names;
+}
+
+// Loading with each of the library's allocators gives the same result.
+static void testAllocators()
+{
+  std::string stub = readFile("test/libobjc.tbd");
+  std::string error;
+  LinkerInterfaceFile * expected = load("test.tbd", stub, error);
+  CHECK(expected != nullptr);
+  if (expected == nullptr) { return; }
+
+  Allocator * allocators[] = {
+    createArenaAllocator(), createPoolAllocator(256),
+  };
+  for (Allocator * allocator : allocators)
+  {
+    CHECK(allocator != nullptr);
+    setAllocator(allocator);
+    CHECK(&getAllocator() == allocator);
+    LinkerInterfaceFile * file = load("test.tbd", stub, error);
+    setAllocator(nullptr);
+    CHECK(file != nullptr);
+    if (file) { CHECK(exportNames(*file) == exportNames(*expected)); }
+    delete file;
+    delete allocator;
+  }
+  delete expected;
+}
+
+// Only the slice for the selected architecture has to be valid, and an
+// architecture we don't know never matches anything.
+static void testMachOSlices()
+{
+  std::string fat = readFile("test/libfat.dylib");
+  CHECK(LinkerInterfaceFile::isSupported("libfat.dylib",
+    (const uint8_t *)fat.data(), fat.size()));
+
+  std::string error;
+  LinkerInterfaceFile * file = load("libfat.dylib", fat, error);
+  CHECK(file != nullptr);
+  delete file;
+
+  const cpu_type_t cpuTypeARM64 = 0x0100000c;
+  file = load("libfat.dylib", fat, error, cpuTypeARM64, 0);
+  CHECK(file == nullptr);
+  CHECK(error == "Unrecognized desired architecture.");
+  delete file;
+
+  // A thin file for an architecture we don't know is not picked, even
+  // with ABI-compatible matching.
+  std::string thin = readFile("test/libthin.dylib");
+  thin[4] = 0x0c;
+  file = load("libthin.dylib", thin, error);
+  CHECK(file == nullptr);
+  CHECK(error.find("missing required architecture") == 0);
+  delete file;
+}
+
+// Checks the answer of the header scanner, and that it agrees with the full
+// parser when it has an answer.
+static void checkScan(const std::string & text, HeaderAnswer expected,
+  bool sameAsParser = true)
+{
+  unsigned failuresBefore = failureCount;
+  const uint8_t * data = (const uint8_t *)text.data();
+  HeaderAnswer answer = scanForInstallAPIFlag(data, text.size());
+  CHECK(answer == expected);
+  if (answer != HeaderAnswer::Unknown && sameAsParser)
+  {
+    std::string error;
+    StubData d = parseYAML(data, text.size(), error);
+    CHECK(error.empty());
+    CHECK(d.installAPI == (answer == HeaderAnswer::Yes));
+  }
+  if (failureCount != failuresBefore)
+  {
+    std::cout << "  for this input:\n" << text << std::endl;
+  }
+}
+
+static void testHeaderScan()
+{
+  const std::string start = "--- !tapi-tbd-v2\narchs: [ x86_64 ]\n";
+  const std::string exports =
+    "exports:\n  - archs: [ x86_64 ]\n    symbols: [ _a ]\n";
+
+  checkScan(start + "flags: [ installapi ]\n" + exports, HeaderAnswer::Yes);
+  checkScan(start + "flags: [ flat_namespace ]\n" + exports,
+    HeaderAnswer::No);
+
+  // Missing flags key.
+  checkScan(start + "install-name: /usr/lib/liba.dylib\n" + exports,
+    HeaderAnswer::No);
+  checkScan(start, HeaderAnswer::No);
+
+  // The value on a continuation line.
+  checkScan(start + "flags:\n  [ installapi ]\n" + exports,
+    HeaderAnswer::Yes);
+  checkScan(start + "flags:\n  - flat_namespace\n  - installapi\n" +
+    exports, HeaderAnswer::Yes);
+  checkScan(start + "flags:\n- installapi\n" + exports, HeaderAnswer::Yes);
+  checkScan(start + "flags: [ flat_namespace,\n         installapi ]\n" +
+    exports, HeaderAnswer::Yes);
+  checkScan(start + "flags: [ flat_namespace, # comment\n  installapi ]\n" +
+    exports, HeaderAnswer::Yes);
+
+  // Text that looks like a flags key, but is inside some other value.
+  checkScan(start + "allowable-clients: [ a,\nflags: [ installapi ] ]\n" +
+    exports, HeaderAnswer::No);
+  checkScan(start + "parent-umbrella: |\n  flags: [ installapi ]\n" +
+    exports, HeaderAnswer::No);
+  checkScan(start + "# flags: [ installapi ]\n" + exports, HeaderAnswer::No);
+  checkScan(start + exports + "...\n--- !tapi-tbd-v2\n"
+    "flags: [ installapi ]\n", HeaderAnswer::No);
+
+  // Things the scanner doesn't handle.
+  checkScan(start + "install-name: \"/usr/lib/a\nflags: [ installapi ]\"\n" +
+    exports, HeaderAnswer::Unknown);
+  checkScan(start + "flags: [ installapi ]\nflags: [ installapi ]\n" +
+    exports, HeaderAnswer::Unknown);
+  checkScan(start + "flags: &f [ installapi ]\n" + exports,
+    HeaderAnswer::Unknown);
+  checkScan("---\n  archs: [ x86_64 ]\n  flags: [ installapi ]\n",
+    HeaderAnswer::Unknown);
+
+  // Keys after the symbol lists are not read.
+  checkScan(start + exports + "flags: [ installapi ]\n", HeaderAnswer::No,
+    false);
+}
+
+// shouldPreferTextBasedStubFile notices when the file changes.
+static void testPreferTextCache()
+{
+  char path[] = "/tmp/tapi-test-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd != -1);
+  if (fd == -1) { return; }
+  close(fd);
+
+  std::string text = "---\narchs: [ x86_64 ]\nflags: [ ]\n...\n";
+  std::ofstream(path, std::ios::binary) << text;
+  CHECK(!LinkerInterfaceFile::shouldPreferTextBasedStubFile(path));
+  CHECK(!LinkerInterfaceFile::shouldPreferTextBasedStubFile(path));
+
+  text = "---\narchs: [ x86_64 ]\nflags: [ installapi ]\n...\n";
+  std::ofstream(path, std::ios::binary) << text;
+  CHECK(LinkerInterfaceFile::shouldPreferTextBasedStubFile(path));
+
+  unlink(path);
+}
+
+static bool equivalentTo(const std::string & dylibPath,
+  const std::string & tbd)
+{
+  char path[] = "/tmp/tapi-test-XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd != -1);
+  if (fd == -1) { return false; }
+  close(fd);
+  std::ofstream(path, std::ios::binary) << tbd;
+  bool result = LinkerInterfaceFile::areEquivalent(path, dylibPath);
+  unlink(path);
+  return result;
+}
+
+// A TBD file is equivalent to a dylib if they have the same install name and
+// the same UUID for an architecture.
+static void testAreEquivalent()
+{
+  const std::string start = "--- !tapi-tbd-v2\narchs: [ x86_64 ]\n";
+  const std::string uuids =
+    "uuids: [ 'x86_64: 4C4C4453-5555-3144-A1B5-A08A0C9A8FD8' ]\n";
+  const std::string installName = "install-name: /usr/lib/libthin.dylib\n";
+  const std::string exports =
+    "exports:\n  - archs: [ x86_64 ]\n    symbols: [ _a ]\n...\n";
+
+  CHECK(equivalentTo("test/libthin.dylib",
+    start + uuids + installName + exports));
+  CHECK(equivalentTo("test/libfat.dylib", start +
+    "uuids: [ 'x86_64h: 00112233-4455-6677-8899-AABBCCDDEEFF' ]\n"
+    "install-name: /usr/lib/libfat.dylib\n" + exports));
+
+  // Mismatched UUIDs.
+  CHECK(!equivalentTo("test/libthin.dylib", start +
+    "uuids: [ 'x86_64: 4C4C4453-5555-3144-A1B5-A08A0C9A8FD9' ]\n" +
+    installName + exports));
+  CHECK(!equivalentTo("test/libthin.dylib", start +
+    "uuids: [ 'x86_64h: 4C4C4453-5555-3144-A1B5-A08A0C9A8FD8' ]\n" +
+    installName + exports));
+  CHECK(!equivalentTo("test/libthin.dylib", start + installName + exports));
+
+  // Mismatched install names.
+  CHECK(!equivalentTo("test/libthin.dylib", start + uuids +
+    "install-name: /usr/lib/libother.dylib\n" + exports));
+  CHECK(!equivalentTo("test/libthin.dylib", start + uuids + exports));
+  CHECK(!equivalentTo("test/libfat.dylib",
+    start + uuids + installName + exports));
+
+  // YAML the header scanner doesn't handle still works.
+  CHECK(equivalentTo("test/libthin.dylib", start + "uuids: &u\n"
+    "  - 'x86_64: 4C4C4453-5555-3144-A1B5-A08A0C9A8FD8'\n" + installName +
+    exports));
+}
+
+static bool sameSymbols(const std::vector<Symbol> & a,
+  const std::vector<Symbol> & b)
+{
+  if (a.size() != b.size()) { return false; }
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    if (a[i].getName() != b[i].getName() ||
+      a[i].getKind() != b[i].getKind() ||
+      a[i].isWeakDefined() != b[i].isWeakDefined() ||
+      a[i].isThreadLocalValue() != b[i].isThreadLocalValue())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Materializing symbols on several threads gives the same result as doing
+// it on one, and the workers of createBatch don't start more threads.
+static void testParallelSymbols()
+{
+  std::string stub = makeStub(parallelSymbolThreshold * 2 + 100);
+  std::string error;
+  StubData d = parseYAML((const uint8_t *)stub.data(), stub.size(), error);
+  CHECK(error.empty());
+
+  std::vector<Symbol> serial;
+  addAllSymbols(serial, d, SectionKind::Export, Architecture::x86_64, 1);
+  CHECK(serial.size() == parallelSymbolThreshold * 2 + 104);
+  for (unsigned threads : { 2, 4, 16 })
+  {
+    std::vector<Symbol> parallel;
+    addAllSymbols(parallel, d, SectionKind::Export, Architecture::x86_64,
+      threads);
+    CHECK(sameSymbols(parallel, serial));
+  }
+
+  unsigned limit = 0;
+  std::thread([&]() { onBatchWorker = true; limit = symbolThreadLimit(); })
+    .join();
+  CHECK(limit == 1);
+}
+
+// The limits are checked while the document is loaded, with each alias
+// counting as the nodes it refers to.
+static void testParseLimits()
+{
+  std::string stub = "--- !tapi-tbd-v2\narchs: &a [ x86_64 ]\n"
+    "install-name: /usr/lib/liba.dylib\nexports:\n"
+    "  - archs: *a\n    symbols: [ _a, _b ]\n...\n";
+  std::string error;
+  StubData d = parseYAML((const uint8_t *)stub.data(), stub.size(), error);
+  CHECK(error.empty());
+  CHECK(d.symbols.size() == 2);
+
+  // The root has 3 keys, the archs list (2 nodes), the install name and
+  // the export list.  The export list has an item with 2 keys, the alias
+  // of the archs list (2 nodes) and the symbol list (3 nodes).
+  const size_t nodeCount = 1 + 3 + 2 + 1 + 1 + 1 + 2 + 2 + 3;
+  ParseLimits saved = getParseLimits();
+  for (size_t limit : { nodeCount - 1, nodeCount })
+  {
+    ParseLimits limits = saved;
+    limits.maxNodeCount = limit;
+    setParseLimits(limits);
+    CHECK(getParseLimits().maxNodeCount == limit);
+    error.clear();
+    parseYAML((const uint8_t *)stub.data(), stub.size(), error);
+    CHECK(error.empty() == (limit == nodeCount));
+  }
+
+  ParseLimits limits = saved;
+  limits.maxAliasCount = 0;
+  setParseLimits(limits);
+  error.clear();
+  parseYAML((const uint8_t *)stub.data(), stub.size(), error);
+  CHECK(error.find("too many aliases") != std::string::npos);
+  setParseLimits(saved);
+}
+
+// Reading a batch of files gives the contents of each file, or an error
+// for a missing one, whether the files are read with io_uring or not.
+static void testBatchReading()
+{
+  std::vector<std::string> paths = {
+    "test/libfoo.tbd", "test/missing.tbd", "test/libthin.dylib",
+    "test/libobjc.tbd",
+  };
+
+  // The normal way.
+  for (const std::string & path : paths)
+  {
+    BatchFile file;
+    file.path = &path;
+    std::string error;
+    bool loaded = readWholeFile(file, error);
+    if (path == "test/missing.tbd")
+    {
+      CHECK(!loaded);
+      CHECK(error == "Failed to open test/missing.tbd: "
+        "No such file or directory.");
+      continue;
+    }
+    CHECK(loaded && file.loaded && error.empty());
+    CHECK(std::string(file.data.begin(), file.data.end()) == readFile(path));
+  }
+
+#ifdef TAPI_HAVE_IO_URING
+  // With io_uring, every file is pushed onto the queue once, and the ones
+  // it loaded have the right contents.
+  std::vector<BatchFile> files(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) { files[i].path = &paths[i]; }
+  BatchQueue queue;
+  if (readFilesWithIOURing(files, queue, files.size() + 1))
+  {
+    queue.close();
+    std::vector<unsigned> pushed(files.size());
+    size_t i;
+    while (queue.pop(i))
+    {
+      pushed[i]++;
+      const BatchFile & file = files[i];
+      CHECK(file.fd == -1);
+      if (file.loaded)
+      {
+        std::string data(file.data.begin(), file.data.end());
+        CHECK(data == readFile(paths[i]));
+      }
+    }
+    for (size_t i = 0; i < files.size(); i++) { CHECK(pushed[i] == 1); }
+    CHECK(!files[1].loaded);
+    CHECK(files[0].loaded && files[2].loaded && files[3].loaded);
+  }
+#endif
+
+  // createBatch reports the missing file and loads the others.
+  std::vector<BatchLoadResult> results = LinkerInterfaceFile::createBatch(
+    paths, CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL,
+    CpuSubTypeMatching::ABI_Compatible, PackedVersion32(10, 11, 0));
+  CHECK(results.size() == paths.size());
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const BatchLoadResult & result = results[i];
+    CHECK(result.path == paths[i]);
+    if (i == 1)
+    {
+      CHECK(result.file == nullptr);
+      CHECK(result.errorMessage.find("Failed to open") == 0);
+      continue;
+    }
+    std::string error;
+    LinkerInterfaceFile * expected = load(paths[i], readFile(paths[i]),
+      error);
+    CHECK(result.file != nullptr && expected != nullptr);
+    if (result.file && expected)
+    {
+      CHECK(exportNames(*result.file) == exportNames(*expected));
+    }
+    delete expected;
+    delete result.file;
+  }
+}
+
+// Loading a batch for several architectures at once gives the same files
+// as loading it for each one.
+static void testMultiArchBatch()
+{
+  std::vector<std::string> paths = {
+    "test/libfoo.tbd", "test/missing.tbd", "test/libfat.dylib",
+    "test/libobjc.tbd",
+  };
+  std::vector<BatchArch> archs = {
+    { CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL },
+    { CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_H },
+    { CPU_TYPE_I386, CPU_SUBTYPE_I386_ALL },
+  };
+  PackedVersion32 minOSVersion(10, 11, 0);
+
+  std::vector<MultiArchLoadResult> results = LinkerInterfaceFile::createBatch(
+    paths, archs, CpuSubTypeMatching::Exact, minOSVersion);
+  CHECK(results.size() == paths.size());
+  CHECK(results[1].errorMessage.find("Failed to open") == 0);
+  CHECK(results[1].archs.empty());
+
+  for (size_t a = 0; a < archs.size(); a++)
+  {
+    std::vector<BatchLoadResult> expected = LinkerInterfaceFile::createBatch(
+      paths, archs[a].cpuType, archs[a].cpuSubType,
+      CpuSubTypeMatching::Exact, minOSVersion);
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+      if (i == 1) { continue; }
+      CHECK(results[i].errorMessage.empty());
+      CHECK(results[i].archs.size() == archs.size());
+      if (results[i].archs.size() != archs.size()) { continue; }
+      const BatchLoadResult & result = results[i].archs[a];
+      CHECK(result.path == paths[i]);
+      CHECK(result.errorMessage == expected[i].errorMessage);
+      CHECK((result.file == nullptr) == (expected[i].file == nullptr));
+      if (result.file && expected[i].file)
+      {
+        CHECK(exportNames(*result.file) == exportNames(*expected[i].file));
+        CHECK(result.file->getInstallName() ==
+          expected[i].file->getInstallName());
+      }
+      delete expected[i].file;
+    }
+  }
+
+  for (MultiArchLoadResult & result : results)
+  {
+    for (BatchLoadResult & archResult : result.archs)
+    {
+      delete archResult.file;
+    }
+  }
+}
+
+// Records what visitSymbols reports, in the form that it should match the
+// LinkerInterfaceFile.
+class RecordingVisitor : public SymbolVisitor
+{
+public:
+  std::vector<std::string> exports, hidden, undefineds, reexports;
+
+  void visitExport(const SymbolView & sym) override
+  {
+    std::string name(sym.name, sym.nameSize);
+    if (sym.hidden)
+    {
+      hidden.push_back(name);
+      return;
+    }
+    if (sym.weak) { name += " (weak)"; }
+    if (sym.threadLocal) { name += " (thread local)"; }
+    exports.push_back(name);
+  }
+
+  void visitUndefined(const SymbolView & sym) override
+  {
+    undefineds.push_back(std::string(sym.name, sym.nameSize));
+  }
+
+  void visitReexport(const char * name, size_t nameSize) override
+  {
+    reexports.push_back(std::string(name, nameSize));
+  }
+};
+
+// visitSymbols reports the same symbols, in the same order, as create.
+static void testVisitSymbols()
+{
+  std::vector<std::string> paths = {
+    "test/libfoo.tbd", "test/libobjc.tbd", "test/libversion.tbd",
+    "test/libinstallapi.tbd", "test/libthin.dylib", "test/libfat.dylib",
+  };
+  const cpu_type_t cpuTypes[] = { CPU_TYPE_X86_64, CPU_TYPE_I386 };
+  for (const std::string & path : paths)
+  {
+    std::string data = readFile(path);
+    for (PackedVersion32 minOSVersion :
+      { PackedVersion32(10, 11, 0), PackedVersion32(10, 14, 0) })
+    {
+      for (cpu_type_t cpuType : cpuTypes)
+      {
+        cpu_subtype_t cpuSubType = CPU_SUBTYPE_X86_64_ALL;
+        std::string error;
+        LinkerInterfaceFile * file = LinkerInterfaceFile::create(path,
+          (const uint8_t *)data.data(), data.size(), cpuType, cpuSubType,
+          CpuSubTypeMatching::Exact, minOSVersion, error);
+
+        RecordingVisitor visitor;
+        std::string visitError;
+        bool success = LinkerInterfaceFile::visitSymbols(path,
+          (const uint8_t *)data.data(), data.size(), cpuType, cpuSubType,
+          CpuSubTypeMatching::Exact, minOSVersion, visitor, visitError);
+        CHECK(success == (file != nullptr));
+        CHECK(visitError == error);
+        if (file == nullptr) { continue; }
+
+        std::vector<std::string> exports, undefineds;
+        for (const Symbol & sym : file->exports())
+        {
+          std::string name = sym.getName();
+          if (sym.isWeakDefined()) { name += " (weak)"; }
+          if (sym.isThreadLocalValue()) { name += " (thread local)"; }
+          exports.push_back(name);
+        }
+        for (const Symbol & sym : file->undefineds())
+        {
+          undefineds.push_back(sym.getName());
+        }
+        CHECK(visitor.exports == exports);
+        CHECK(visitor.hidden == file->ignoreExports());
+        CHECK(visitor.undefineds == undefineds);
+        CHECK(visitor.reexports == file->reexportedLibraries());
+        delete file;
+      }
+    }
+  }
+}
+
+// Checks that exportsWithPrefix returns exactly the exports that start
+// with the prefix.
+static bool prefixQueryMatches(LinkerInterfaceFile & file,
+  const std::string & prefix)
+{
+  SymbolRange range = file.exportsWithPrefix(prefix);
+  std::vector<std::string> expected, actual;
+  for (const Symbol & sym : file.exports())
+  {
+    if (sym.getName().compare(0, prefix.size(), prefix) == 0)
+    {
+      expected.push_back(sym.getName());
+    }
+  }
+  for (const Symbol & sym : range) { actual.push_back(sym.getName()); }
+  return actual == expected;
+}
+
+// exportsWithPrefix sorts the symbols itself if they aren't sorted yet.
+static void testExportsWithPrefix()
+{
+  for (const char * path : { "test/libobjc.tbd", "test/libfoo.tbd" })
+  {
+    std::string error;
+    LinkerInterfaceFile * file = load(path, readFile(path), error);
+    CHECK(file != nullptr);
+    if (file == nullptr) { continue; }
+
+    CHECK(!file->hasSortedSymbols());
+    CHECK(file->exportsWithPrefix("_").size() == file->exports().size());
+    CHECK(file->hasSortedSymbols());
+    CHECK(std::is_sorted(file->exports().begin(), file->exports().end(),
+      [](const Symbol & a, const Symbol & b)
+      {
+        return a.getName() < b.getName();
+      }));
+
+    for (const char * prefix : { "", "_", "_OBJC_CLASS_$_",
+      "_OBJC_METACLASS_$_", "_foo", "~" })
+    {
+      CHECK(prefixQueryMatches(*file, prefix));
+    }
+    delete file;
+  }
+}
+
+// Hide commands are parsed in place, without reading past the name.
+static void testHideCommands()
+{
+  struct Case
+  {
+    const char * name;
+    bool valid;
+    PackedVersion32 osVersion;
+    const char * hidden;
+  };
+  const Case cases[] = {
+    { "$ld$hide$os10.12$_foo", true, PackedVersion32(10, 12, 0), "_foo" },
+    { "$ld$hide$os10.4.1$_foo$bar", true, PackedVersion32(10, 4, 1),
+      "_foo$bar" },
+    { "$ld$hide$os10.12$", true, PackedVersion32(10, 12, 0), "" },
+    { "$ld$hide$os10.12", false, PackedVersion32(), "" },
+    { "$ld$hide$os", false, PackedVersion32(), "" },
+    { "$ld$hide$10.12$_foo", false, PackedVersion32(), "" },
+  };
+  for (const Case & c : cases)
+  {
+    // A copy with no terminator, so that ASan catches reads past the end.
+    std::vector<char> name(c.name, c.name + strlen(c.name));
+    PackedVersion32 osVersion;
+    size_t hiddenStart = 0;
+    bool valid = parseHideCommand(name.data(), name.size(), osVersion,
+      hiddenStart);
+    CHECK(valid == c.valid);
+    if (!valid) { continue; }
+    CHECK(osVersion == c.osVersion);
+    CHECK(std::string(name.data() + hiddenStart, name.data() + name.size()) ==
+      c.hidden);
+  }
+}
+
+// A repeated top-level key is an error, rather than mixing the two values.
+static void testDuplicateKeys()
+{
+  const std::string start = "--- !tapi-tbd-v2\narchs: [ x86_64 ]\n"
+    "install-name: /usr/lib/liba.dylib\n";
+  const std::string exports =
+    "exports:\n  - archs: [ x86_64 ]\n    symbols: [ _a ]\n";
+  for (const std::string & stub : {
+    start + exports + exports,
+    start + exports + "archs: [ i386 ]\n",
+    start + "install-name: /usr/lib/libb.dylib\n" + exports })
+  {
+    std::string error;
+    parseYAML((const uint8_t *)stub.data(), stub.size(), error);
+    CHECK(error.find("Root mapping has a duplicate key") == 0);
+  }
+}
+
+// Loads a file with createForSymbols and checks that it matches create
+// restricted to the wanted names.
+static void checkWantedSymbols(const std::string & data,
+  const std::vector<std::string> & wanted, size_t expectedExports)
+{
+  std::string error;
+  LinkerInterfaceFile * full = load("test.tbd", data, error);
+  CHECK(full != nullptr);
+  LinkerInterfaceFile * partial = LinkerInterfaceFile::createForSymbols(
+    "test.tbd", (const uint8_t *)data.data(), data.size(), CPU_TYPE_X86_64,
+    CPU_SUBTYPE_X86_64_ALL, CpuSubTypeMatching::ABI_Compatible,
+    PackedVersion32(10, 11, 0), wanted, error);
+  CHECK(partial != nullptr);
+  if (full && partial)
+  {
+    std::set<std::string> wantedSet(wanted.begin(), wanted.end());
+    std::vector<Symbol> exports;
+    for (const Symbol & sym : full->exports())
+    {
+      if (wantedSet.count(sym.getName())) { exports.push_back(sym); }
+    }
+    std::vector<std::string> hidden;
+    for (const std::string & name : full->ignoreExports())
+    {
+      if (wantedSet.count(name)) { hidden.push_back(name); }
+    }
+    CHECK(sameSymbols(partial->exports(), exports));
+    CHECK(partial->exports().size() == expectedExports);
+    CHECK(partial->ignoreExports() == hidden);
+    CHECK(partial->reexportedLibraries() == full->reexportedLibraries());
+    CHECK(partial->undefineds().empty());
+  }
+  delete full;
+  delete partial;
+}
+
+// createForSymbols gives the same exports, hidden names and re-exports as
+// create for the names it was asked about.
+static void testCreateForSymbols()
+{
+  std::string foo = readFile("test/libfoo.tbd");
+  std::string objc = readFile("test/libobjc.tbd");
+
+  // _foo_newfangled is hidden by $ld$hide, and _missing is not in the stub.
+  checkWantedSymbols(foo, { "_foo_create", "_foo_newfangled", "_missing" },
+    1);
+  checkWantedSymbols(foo, { "_foo_weak", "_OBJC_METACLASS_$_Foo",
+    "_OBJC_IVAR_$_Foo.car" }, 3);
+  checkWantedSymbols(foo, { }, 0);
+  checkWantedSymbols(objc, { "_OBJC_CLASS_$_Bar", "_OBJC_EHTYPE_$_Bar",
+    "_OBJC_IVAR_$_Bar.baz", "_tlv_counter", "_Bar" }, 4);
+
+  // Every wanted name is in the first section, so the rest are skipped;
+  // then the same with the last name only in the last section.
+  const std::string start = "--- !tapi-tbd-v2\narchs: [ x86_64 ]\n"
+    "install-name: /usr/lib/liba.dylib\nexports:\n"
+    "  - archs: [ x86_64 ]\n    symbols: [ _a, _b ]\n"
+    "  - archs: [ x86_64 ]\n    symbols: [ _c, _d ]\n"
+    "    re-exports: [ /usr/lib/libb.dylib ]\n";
+  checkWantedSymbols(start + "...\n", { "_b", "_a" }, 2);
+  checkWantedSymbols(start + "...\n", { "_a", "_d" }, 2);
+  checkWantedSymbols(start + "  - archs: [ x86_64 ]\n"
+    "    symbols: [ _e, '$ld$hide$os10.12$_a' ]\n...\n", { "_a" }, 0);
+}
+
+int main()
+{
+  testMayExport();
+  testAllocators();
+  testMachOSlices();
+  testHeaderScan();
+  testPreferTextCache();
+  testAreEquivalent();
+  testParallelSymbols();
+  testParseLimits();
+  testBatchReading();
+  testMultiArchBatch();
+  testVisitSymbols();
+  testExportsWithPrefix();
+  testHideCommands();
+  testDuplicateKeys();
+  testCreateForSymbols();
+
+  if (failureCount)
+  {
+    std::cout << failureCount << " checks failed." << std::endl;
+    return 1;
+  }
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}